@@ -0,0 +1,206 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID-BPF counterpart of hid-cougar for kernels with HID-BPF struct_ops
+ *
+ *  Instead of injecting translated codes into the keyboard interface's
+ *  input device, the vendor interface's descriptor is replaced by a plain
+ *  keyboard/consumer descriptor and every vendor report is rewritten into
+ *  a report of that descriptor, so hid-generic emits the keys from the
+ *  vendor interface's own input device. The mouse interface gets the same
+ *  usage count clamp as cougar_report_fixup().
+ *
+ *  The keymap is the array map 'cougar_keymap', indexed by vendor code.
+ *  Each value is (HID usage page << 16 | usage), 0 meaning unmapped.
+ *  Only the Keyboard (0x07) and Consumer (0x0c) pages are supported, e.g.
+ *  to map G1 (0x83) to F19 (0x07:0x6e):
+ *
+ *    bpftool map update name cougar_keymap \
+ *        key 0x83 0 0 0 value 0x6e 0 0x07 0
+ */
+
+#include "vmlinux.h"
+#include "hid_bpf.h"
+#include "hid_bpf_helpers.h"
+#include <bpf/bpf_tracing.h>
+
+#define USB_VENDOR_ID_SOLID_YEAR			0x060b
+#define USB_DEVICE_ID_COUGAR_700K_GAMING_KEYBOARD	0x700a
+
+HID_BPF_CONFIG(
+	HID_DEVICE(BUS_USB, HID_GROUP_GENERIC, USB_VENDOR_ID_SOLID_YEAR,
+		   USB_DEVICE_ID_COUGAR_700K_GAMING_KEYBOARD)
+);
+
+#define COUGAR_FIELD_CODE	1
+#define COUGAR_FIELD_ACTION	2
+
+#define COUGAR_KEY_G1		0x83
+#define COUGAR_KEY_G2		0x84
+#define COUGAR_KEY_G3		0x85
+#define COUGAR_KEY_G4		0x86
+#define COUGAR_KEY_G5		0x87
+#define COUGAR_KEY_G6		0x78
+#define COUGAR_KEY_LOCK		0x6e
+
+#define HID_PAGE_KEYBOARD	0x07
+#define HID_PAGE_CONSUMER	0x0c
+#define COUGAR_USAGE(page, usage)	((page) << 16 | (usage))
+
+/* Mouse interface usage count and its clamp, see cougar_report_fixup() */
+#define COUGAR_RDESC_USAGE_COUNT	115
+#define COUGAR_RDESC_USAGE_MAX		0x3ff
+
+#ifndef HID_MAX_DESCRIPTOR_SIZE
+#define HID_MAX_DESCRIPTOR_SIZE		4096
+#endif
+
+#define COUGAR_KEYS_MAX		6
+#define COUGAR_REPORT_SIZE	(COUGAR_KEYS_MAX + 2)
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, 256);
+	__type(key, __u32);
+	__type(value, __u32);
+} cougar_keymap SEC(".maps");
+
+/*
+ * Replacement descriptor for the vendor interface: six keyboard page
+ * array slots followed by one 16-bit consumer page array slot.
+ */
+static const __u8 cougar_vendor_rdesc[] = {
+	0x05, 0x01,		/* Usage Page (Generic Desktop) */
+	0x09, 0x06,		/* Usage (Keyboard) */
+	0xa1, 0x01,		/* Collection (Application) */
+	0x05, 0x07,		/*  Usage Page (Keyboard) */
+	0x19, 0x00,		/*  Usage Minimum (0) */
+	0x29, 0xff,		/*  Usage Maximum (255) */
+	0x15, 0x00,		/*  Logical Minimum (0) */
+	0x26, 0xff, 0x00,	/*  Logical Maximum (255) */
+	0x75, 0x08,		/*  Report Size (8) */
+	0x95, COUGAR_KEYS_MAX,	/*  Report Count (6) */
+	0x81, 0x00,		/*  Input (Data,Arr,Abs) */
+	0x05, 0x0c,		/*  Usage Page (Consumer) */
+	0x19, 0x00,		/*  Usage Minimum (0) */
+	0x2a, 0xff, 0x03,	/*  Usage Maximum (1023) */
+	0x26, 0xff, 0x03,	/*  Logical Maximum (1023) */
+	0x75, 0x10,		/*  Report Size (16) */
+	0x95, 0x01,		/*  Report Count (1) */
+	0x81, 0x00,		/*  Input (Data,Arr,Abs) */
+	0xc0,			/* End Collection */
+};
+
+/* Set by the rdesc fixup when this instance is bound to the vendor intf */
+static bool translate;
+static __u8 pressed[COUGAR_KEYS_MAX];
+static __u16 consumer;
+
+SEC(HID_BPF_RDESC_FIXUP)
+int BPF_PROG(cougar_fix_rdesc, struct hid_bpf_ctx *hctx)
+{
+	__u8 *rdesc = hid_bpf_get_data(hctx, 0, HID_MAX_DESCRIPTOR_SIZE);
+
+	if (!rdesc)
+		return 0;
+
+	/* Vendor interface: Usage Page (0xff00) */
+	if (rdesc[0] == 0x06 && rdesc[1] == 0x00 && rdesc[2] == 0xff) {
+		translate = true;
+		__builtin_memcpy(rdesc, cougar_vendor_rdesc,
+				 sizeof(cougar_vendor_rdesc));
+		return sizeof(cougar_vendor_rdesc);
+	}
+
+	/* Mouse interface */
+	if (hctx->size > COUGAR_RDESC_USAGE_COUNT + 1 &&
+	    rdesc[2] == 0x09 && rdesc[3] == 0x02 &&
+	    (rdesc[COUGAR_RDESC_USAGE_COUNT] |
+	     rdesc[COUGAR_RDESC_USAGE_COUNT + 1] << 8) > COUGAR_RDESC_USAGE_MAX) {
+		rdesc[COUGAR_RDESC_USAGE_COUNT] = COUGAR_RDESC_USAGE_MAX & 0xff;
+		rdesc[COUGAR_RDESC_USAGE_COUNT + 1] = COUGAR_RDESC_USAGE_MAX >> 8;
+	}
+	return 0;
+}
+
+static void cougar_set_key(__u8 usage, bool down)
+{
+	int i, slot = -1;
+
+	for (i = 0; i < COUGAR_KEYS_MAX; i++) {
+		if (pressed[i] == usage) {
+			if (!down)
+				pressed[i] = 0;
+			return;
+		}
+		if (!pressed[i] && slot < 0)
+			slot = i;
+	}
+	if (down && slot >= 0)
+		pressed[slot] = usage;
+}
+
+SEC(HID_BPF_DEVICE_EVENT)
+int BPF_PROG(cougar_translate, struct hid_bpf_ctx *hctx)
+{
+	__u8 *data = hid_bpf_get_data(hctx, 0, COUGAR_REPORT_SIZE);
+	__u32 code, *usage;
+	bool down;
+	int i;
+
+	if (!data || !translate)
+		return 0;
+
+	code = data[COUGAR_FIELD_CODE];
+	down = data[COUGAR_FIELD_ACTION];
+	usage = bpf_map_lookup_elem(&cougar_keymap, &code);
+	if (!usage || !*usage)
+		return -1;	/* drop unmapped codes */
+
+	switch (*usage >> 16) {
+	case HID_PAGE_KEYBOARD:
+		cougar_set_key(*usage & 0xff, down);
+		break;
+	case HID_PAGE_CONSUMER:
+		consumer = down ? *usage & 0x3ff : 0;
+		break;
+	default:
+		return -1;
+	}
+
+	for (i = 0; i < COUGAR_KEYS_MAX; i++)
+		data[i] = pressed[i];
+	data[COUGAR_KEYS_MAX] = consumer & 0xff;
+	data[COUGAR_KEYS_MAX + 1] = consumer >> 8;
+	return COUGAR_REPORT_SIZE;
+}
+
+HID_BPF_OPS(cougar) = {
+	.hid_rdesc_fixup = (void *)cougar_fix_rdesc,
+	.hid_device_event = (void *)cougar_translate,
+};
+
+static void cougar_keymap_set(__u32 code, __u32 usage)
+{
+	bpf_map_update_elem(&cougar_keymap, &code, &usage, BPF_ANY);
+}
+
+/*
+ * Load the default mappings of hid-cougar (with g6_is_space=1)
+ */
+SEC("syscall")
+int probe(struct hid_bpf_probe_args *ctx)
+{
+	cougar_keymap_set(COUGAR_KEY_G6, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x2c));
+	cougar_keymap_set(COUGAR_KEY_G1, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x68));
+	cougar_keymap_set(COUGAR_KEY_G2, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x69));
+	cougar_keymap_set(COUGAR_KEY_G3, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x6a));
+	cougar_keymap_set(COUGAR_KEY_G4, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x6b));
+	cougar_keymap_set(COUGAR_KEY_G5, COUGAR_USAGE(HID_PAGE_KEYBOARD, 0x6c));
+	cougar_keymap_set(COUGAR_KEY_LOCK,
+			  COUGAR_USAGE(HID_PAGE_CONSUMER, 0x19e));
+
+	ctx->retval = 0;
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: aggregated keyboards
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static LIST_HEAD(cougar_aggregate_list);
+
+DEFINE_STATIC_KEY_FALSE(cougar_aggregate_key);
+
+/*
+ * Feed a key event of the group to its aggregated keyboard, if any. The
+ * membership's own 'held' bitmap keeps each key counted once per group.
+ */
+void cougar_aggregate_event(struct cougar_shared *shared, unsigned int code,
+			    s32 value)
+{
+	struct cougar_aggregate_member *member;
+	struct cougar_aggregate *agg;
+	unsigned long flags;
+
+	if (value > 1)
+		return;
+
+	rcu_read_lock();
+	member = rcu_dereference(shared->aggregate);
+	if (member) {
+		agg = member->agg;
+		spin_lock_irqsave(&agg->lock, flags);
+		if (value && !test_and_set_bit(code, member->held)) {
+			if (!agg->count[code]++) {
+				input_event(agg->input, EV_KEY, code, 1);
+				input_sync(agg->input);
+			}
+		} else if (!value && test_and_clear_bit(code, member->held)) {
+			if (!--agg->count[code]) {
+				input_event(agg->input, EV_KEY, code, 0);
+				input_sync(agg->input);
+			}
+		}
+		spin_unlock_irqrestore(&agg->lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+/* Release the keys a group holds on its aggregated keyboard */
+static void cougar_aggregate_release_keys(struct cougar_aggregate_member *member)
+{
+	struct cougar_aggregate *agg = member->agg;
+	unsigned long flags;
+	unsigned int code;
+
+	spin_lock_irqsave(&agg->lock, flags);
+	for_each_set_bit(code, member->held, KEY_CNT) {
+		clear_bit(code, member->held);
+		if (!--agg->count[code])
+			input_event(agg->input, EV_KEY, code, 0);
+	}
+	input_sync(agg->input);
+	spin_unlock_irqrestore(&agg->lock, flags);
+}
+
+/*
+ * Release the keys of a group whose keyboard input went away, once no
+ * report can press any more, see cougar_disable_shared(). They would stay
+ * held, and repeat, on the aggregated keyboard otherwise.
+ */
+void cougar_aggregate_release(struct cougar_shared *shared)
+{
+	struct cougar_aggregate_member *member;
+
+	mutex_lock(&cougar_udev_list_lock);
+	member = rcu_dereference_protected(shared->aggregate,
+					   lockdep_is_held(&cougar_udev_list_lock));
+	if (member)
+		cougar_aggregate_release_keys(member);
+	mutex_unlock(&cougar_udev_list_lock);
+}
+
+/*
+ * Leave the group's aggregated keyboard, releasing the keys it held there
+ * and the keyboard itself once no group uses it. Must be called with
+ * cougar_udev_list_lock held.
+ */
+static void cougar_aggregate_leave(struct cougar_shared *shared)
+{
+	struct cougar_aggregate_member *member;
+	struct cougar_aggregate *agg;
+
+	member = rcu_dereference_protected(shared->aggregate,
+					   lockdep_is_held(&cougar_udev_list_lock));
+	if (!member)
+		return;
+
+	RCU_INIT_POINTER(shared->aggregate, NULL);
+	static_branch_dec(&cougar_aggregate_key);
+	synchronize_rcu();
+
+	agg = member->agg;
+	cougar_aggregate_release_keys(member);
+	kfree(member);
+
+	if (--agg->users)
+		return;
+	list_del(&agg->list);
+	input_unregister_device(agg->input);
+	kfree(agg);
+}
+
+/* Leave the aggregated keyboard of a group no interface uses any more */
+void cougar_aggregate_exit(struct cougar_shared *shared)
+{
+	mutex_lock(&cougar_udev_list_lock);
+	cougar_aggregate_leave(shared);
+	mutex_unlock(&cougar_udev_list_lock);
+}
+
+/*
+ * Find or create the aggregated keyboard 'name'. Must be called with
+ * cougar_udev_list_lock held.
+ */
+static struct cougar_aggregate *cougar_aggregate_get(const char *name)
+{
+	struct cougar_aggregate *agg;
+	unsigned int code;
+
+	list_for_each_entry(agg, &cougar_aggregate_list, list) {
+		if (!strcmp(agg->name, name)) {
+			agg->users++;
+			return agg;
+		}
+	}
+
+	agg = kzalloc(sizeof(*agg), GFP_KERNEL);
+	if (!agg)
+		return NULL;
+	agg->input = input_allocate_device();
+	if (!agg->input) {
+		kfree(agg);
+		return NULL;
+	}
+
+	strscpy(agg->name, name, sizeof(agg->name));
+	snprintf(agg->phys, sizeof(agg->phys), "cougar-aggregate/%s", name);
+	spin_lock_init(&agg->lock);
+	agg->input->name = "Cougar Aggregated Keyboard";
+	agg->input->phys = agg->phys;
+	agg->input->uniq = agg->name;
+	agg->input->id.bustype = BUS_VIRTUAL;
+	agg->input->id.vendor = USB_VENDOR_ID_SOLID_YEAR;
+	agg->input->id.product = USB_DEVICE_ID_COUGAR_700K_GAMING_KEYBOARD;
+	/* Keyboard and consumer keys, leaving out the button ranges */
+	__set_bit(EV_KEY, agg->input->evbit);
+	__set_bit(EV_REP, agg->input->evbit);
+	for (code = KEY_ESC; code < BTN_MISC; code++)
+		__set_bit(code, agg->input->keybit);
+	for (code = KEY_OK; code < BTN_DPAD_UP; code++)
+		__set_bit(code, agg->input->keybit);
+
+	if (input_register_device(agg->input)) {
+		input_free_device(agg->input);
+		kfree(agg);
+		return NULL;
+	}
+	agg->users = 1;
+	list_add_tail(&agg->list, &cougar_aggregate_list);
+	return agg;
+}
+
+/*
+ * sysfs "aggregate": name of the aggregated keyboard the keyboard also
+ * reports its keys to, shared with every keyboard given the same name.
+ * An empty string leaves it.
+ */
+static ssize_t aggregate_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_aggregate_member *member;
+	ssize_t len;
+
+	rcu_read_lock();
+	member = rcu_dereference(cougar->shared->aggregate);
+	len = scnprintf(buf, PAGE_SIZE, "%s\n", member ? member->agg->name : "");
+	rcu_read_unlock();
+	return len;
+}
+
+static ssize_t aggregate_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_shared *shared = cougar->shared;
+	struct cougar_aggregate_member *member = NULL;
+	char *args, *name;
+	int error = 0;
+
+	args = kstrndup(buf, count, GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	name = strim(args);
+	if (strlen(name) >= COUGAR_AGGREGATE_NAME_MAX || strchr(name, ' ')) {
+		kfree(args);
+		return -EINVAL;
+	}
+	if (*name) {
+		member = kzalloc(sizeof(*member), GFP_KERNEL);
+		if (!member) {
+			kfree(args);
+			return -ENOMEM;
+		}
+	}
+
+	mutex_lock(&cougar_udev_list_lock);
+	cougar_aggregate_leave(shared);
+	if (member) {
+		member->agg = cougar_aggregate_get(name);
+		if (member->agg) {
+			rcu_assign_pointer(shared->aggregate, member);
+			static_branch_inc(&cougar_aggregate_key);
+		} else {
+			kfree(member);
+			error = -ENOMEM;
+		}
+	}
+	mutex_unlock(&cougar_udev_list_lock);
+	kfree(args);
+	return error ? error : count;
+}
+struct device_attribute cougar_attr_aggregate = __ATTR_RW(aggregate);
@@ -0,0 +1,886 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ *
+ *  ChangeLog:
+ *    v0.6 (dml) - First submit to kernel.org
+ *    v0.7 (dml) - Deep refactor
+ *       - No usage of usb.h
+ *       - Shared memory now properly managed using krefs.
+ *       - Siblings now properly searched for
+ */
+
+#include "hid-cougar.h"
+
+MODULE_AUTHOR("Daniel M. Lambea <dmlambea@gmail.com>");
+MODULE_DESCRIPTION("Cougar 700k Gaming Keyboard");
+MODULE_LICENSE("GPL");
+MODULE_INFO(key_mappings, "G1-G6 are mapped to F13-F18");
+
+static int cougar_g6_is_space = 1;
+
+/*
+ * The mouse interface declares consumer usages up to 0xffff, more than
+ * hid-core accepts, and hid-core keeps a usage and a value for each one.
+ * Consumer page usages end below 0x400, so its Usage Maximum is clamped
+ * there.
+ */
+#define COUGAR_RDESC_USAGE_MAX	0x3ff
+
+
+/* Default key mappings. The special key COUGAR_KEY_G6 is defined first
+ * because it is more frequent to use the spacebar rather than any other
+ * special keys. Depending on the value of the parameter 'g6_is_space',
+ * the mapping is updated whenever the parameter is set, see
+ * cougar_g6_is_space_set().
+ */
+static unsigned char cougar_mapping[][2] = {
+	{ COUGAR_KEY_G6,   KEY_SPACE },
+	{ COUGAR_KEY_G1,   KEY_F13 },
+	{ COUGAR_KEY_G2,   KEY_F14 },
+	{ COUGAR_KEY_G3,   KEY_F15 },
+	{ COUGAR_KEY_G4,   KEY_F16 },
+	{ COUGAR_KEY_G5,   KEY_F17 },
+	{ COUGAR_KEY_LOCK, KEY_SCREENLOCK },
+/* The following keys are handled by the hardware itself, so no special
+ * treatment is required:
+	{ COUGAR_KEY_FN, KEY_RESERVED },
+	{ COUGAR_KEY_MR, KEY_RESERVED },
+	{ COUGAR_KEY_M1, KEY_RESERVED },
+	{ COUGAR_KEY_M2, KEY_RESERVED },
+	{ COUGAR_KEY_M3, KEY_RESERVED },
+	{ COUGAR_KEY_LEDS, KEY_RESERVED },
+*/
+	{ 0, 0 },
+};
+
+LIST_HEAD(cougar_udev_list);
+DEFINE_MUTEX(cougar_udev_list_lock);
+
+/*
+ * Apply 'g6_is_space' to the default mappings and return the key G6 was
+ * mapped to. Must be called with cougar_udev_list_lock held.
+ */
+static unsigned int cougar_fix_g6_mapping(void)
+{
+	unsigned int old;
+	int i;
+
+	for (i = 0; cougar_mapping[i][0]; i++) {
+		if (cougar_mapping[i][0] == COUGAR_KEY_G6) {
+			old = cougar_mapping[i][1];
+			WRITE_ONCE(cougar_mapping[i][1],
+				   cougar_g6_is_space ? KEY_SPACE : KEY_F18);
+			return old;
+		}
+	}
+	pr_warn("no mapping defined for G6/spacebar\n");
+	return 0;
+}
+
+/*
+ * Advertise every key code the driver may inject into the keyboard intf,
+ * or the input core would silently drop them
+ */
+static void cougar_set_keybits(struct input_dev *input)
+{
+	int i;
+
+	for (i = 0; cougar_mapping[i][0]; i++)
+		input_set_capability(input, EV_KEY, cougar_mapping[i][1]);
+	/* G6 may be switched between space and F18 at any time */
+	input_set_capability(input, EV_KEY, KEY_F18);
+}
+
+/*
+ * Same for the codes of the group's current layer and dual-role keys.
+ * Must be called with cougar_udev_list_lock held.
+ */
+void cougar_update_keybits(struct cougar_shared *shared)
+{
+	if (!shared->input)
+		return;
+
+	cougar_layer_keybits(shared);
+	cougar_modmap_keybits(shared);
+	cougar_dual_keybits(shared);
+}
+
+/*
+ * Constant-friendly rdesc fixup for mouse interface
+ */
+static cougar_rdesc_t *cougar_report_fixup(struct hid_device *hdev,
+					   __u8 *rdesc, unsigned int *rsize)
+{
+	if (*rsize > 116 && rdesc[2] == 0x09 && rdesc[3] == 0x02 &&
+	    (rdesc[115] | rdesc[116] << 8) > COUGAR_RDESC_USAGE_MAX) {
+		hid_info(hdev,
+			"usage count exceeds max: fixing up report descriptor\n");
+		rdesc[115] = COUGAR_RDESC_USAGE_MAX & 0xff;
+		rdesc[116] = COUGAR_RDESC_USAGE_MAX >> 8;
+	}
+	return rdesc;
+}
+
+/*
+ * Report a key of the group on 'input' and on its aggregated keyboard,
+ * and track it for autorepeat
+ */
+void cougar_key(struct cougar_shared *shared, struct input_dev *input,
+		unsigned int code, s32 value)
+{
+	input_event(input, EV_KEY, code, value);
+	if (cougar_aggregate_active())
+		cougar_aggregate_event(shared, code, value);
+	if (cougar_repeat_active())
+		cougar_repeat_event(shared, input, code, value);
+}
+
+/*
+ * Switch G6 between space and F18 on the bound keyboards too. Vendor
+ * reports look the mapping up under rcu_read_lock(), so once the grace
+ * period is over none can still emit the old key, and a G6 held across
+ * the switch is released here. The key state of the input can't tell it
+ * from the real spacebar, hence 'g6_key'.
+ */
+static int cougar_g6_is_space_set(const char *val,
+				  const struct kernel_param *kp)
+{
+	struct cougar_shared *shared;
+	unsigned int old;
+	int error;
+
+	error = param_set_int(val, kp);
+	if (error)
+		return error;
+
+	mutex_lock(&cougar_udev_list_lock);
+	old = cougar_fix_g6_mapping();
+	if (old && old != (cougar_g6_is_space ? KEY_SPACE : KEY_F18)) {
+		synchronize_rcu();
+		list_for_each_entry(shared, &cougar_udev_list, list) {
+			/* Not a G6 pressed since, with the new key */
+			if (cmpxchg(&shared->g6_key, old, 0) != old ||
+			    !shared->input)
+				continue;
+			cougar_key(shared, shared->input, old, 0);
+			input_sync(shared->input);
+		}
+	}
+	mutex_unlock(&cougar_udev_list_lock);
+	return 0;
+}
+
+static const struct kernel_param_ops cougar_g6_is_space_ops = {
+	.set = cougar_g6_is_space_set,
+	.get = param_get_int,
+};
+module_param_cb(g6_is_space, &cougar_g6_is_space_ops, &cougar_g6_is_space,
+		0600);
+MODULE_PARM_DESC(g6_is_space,
+	"If set, G6 programmable key sends SPACE instead of F18, applied to bound keyboards right away (0=off, 1=on) (default=1)");
+
+/*
+ * From wacom_sys.c
+ */
+static bool compare_device_paths(struct hid_device *hdev_a,
+				 struct hid_device *hdev_b, char separator)
+{
+	int n1 = strrchr(hdev_a->phys, separator) - hdev_a->phys;
+	int n2 = strrchr(hdev_b->phys, separator) - hdev_b->phys;
+
+	if (n1 != n2 || n1 <= 0 || n2 <= 0)
+		return false;
+
+	return !strncmp(hdev_a->phys, hdev_b->phys, n1);
+}
+
+/*
+ * Derived from wacom_sys.c
+ */
+static struct cougar_shared *cougar_get_shared_data(struct hid_device *hdev)
+{
+	struct cougar_shared *shared;
+
+	/* Try to find an already-probed interface from the same device */
+	list_for_each_entry(shared, &cougar_udev_list, list) {
+		if (compare_device_paths(hdev, shared->dev, '/')) {
+			kref_get(&shared->kref);
+			return shared;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Derived from wacom_sys.c
+ */
+static void cougar_release_shared_data(struct kref *kref)
+{
+	struct cougar_shared *shared = container_of(kref,
+						    struct cougar_shared, kref);
+
+	mutex_lock(&cougar_udev_list_lock);
+	list_del(&shared->list);
+	mutex_unlock(&cougar_udev_list_lock);
+
+	cougar_ring_exit(shared);
+	cougar_dual_exit(shared);
+	cougar_layer_exit(shared);
+	cougar_modmap_exit(shared);
+	cougar_mouse_exit(shared);
+	cougar_aggregate_exit(shared);
+	cougar_repeat_exit(shared);
+	kfree(shared);
+}
+
+/*
+ * Free the optional per-interface state of a slot being released, once
+ * no report or parameter update can reach it
+ */
+static void cougar_unbind(struct cougar *cougar)
+{
+	cougar_stats_unbind(cougar);
+	cougar_storm_unbind(cougar);
+	cougar_inject_unbind(cougar);
+}
+
+/*
+ * Derived from wacom_sys.c
+ */
+static void cougar_remove_shared_data(void *resource)
+{
+	struct cougar *cougar = resource;
+	struct cougar_shared *shared = cougar->shared;
+
+	if (shared) {
+		mutex_lock(&cougar_udev_list_lock);
+		cougar->shared = NULL;
+		mutex_unlock(&cougar_udev_list_lock);
+		cougar_unbind(cougar);
+		kref_put(&shared->kref, cougar_release_shared_data);
+	}
+}
+
+/*
+ * Call 'fn' on every bound interface, with cougar_udev_list_lock held,
+ * for parameters that give them state when enabled
+ */
+void cougar_for_each_intf(void (*fn)(struct cougar *cougar))
+{
+	struct cougar_shared *shared;
+	int i;
+
+	mutex_lock(&cougar_udev_list_lock);
+	list_for_each_entry(shared, &cougar_udev_list, list)
+		for (i = 0; i < COUGAR_MAX_INTF; i++)
+			if (shared->intf[i].shared)
+				fn(&shared->intf[i]);
+	mutex_unlock(&cougar_udev_list_lock);
+}
+
+/*
+ * Bind the device group's shared data to this interface and claim a slot
+ * for its state. If no shared data exists for this group, create and
+ * initialize it.
+ */
+static struct cougar *cougar_bind_shared_data(struct hid_device *hdev,
+					      struct cougar_probe_times *t)
+{
+	struct cougar_shared *shared;
+	struct cougar *cougar = NULL;
+	ktime_t start = ktime_get();
+	int i, error;
+
+	mutex_lock(&cougar_udev_list_lock);
+	t->lock_wait = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	shared = cougar_get_shared_data(hdev);
+	if (!shared) {
+		shared = kzalloc(sizeof(*shared), GFP_KERNEL);
+		if (!shared) {
+			cougar = ERR_PTR(-ENOMEM);
+			goto out;
+		}
+
+		error = cougar_ring_init(shared);
+		if (error) {
+			kfree(shared);
+			cougar = ERR_PTR(error);
+			goto out;
+		}
+
+		kref_init(&shared->kref);
+		shared->dev = hdev;
+		list_add_tail(&shared->list, &cougar_udev_list);
+	}
+
+	for (i = 0; i < COUGAR_MAX_INTF; i++) {
+		if (!shared->intf[i].shared) {
+			cougar = &shared->intf[i];
+			break;
+		}
+	}
+	if (!cougar) {
+		mutex_unlock(&cougar_udev_list_lock);
+		kref_put(&shared->kref, cougar_release_shared_data);
+		hid_err(hdev, "too many interfaces in device group\n");
+		return ERR_PTR(-ENOSPC);
+	}
+
+	memset(cougar, 0, sizeof(*cougar));
+	cougar->shared = shared;
+
+	error = devm_add_action(&hdev->dev, cougar_remove_shared_data, cougar);
+	if (error) {
+		mutex_unlock(&cougar_udev_list_lock);
+		cougar_remove_shared_data(cougar);
+		return ERR_PTR(error);
+	}
+
+out:
+	mutex_unlock(&cougar_udev_list_lock);
+	return cougar;
+}
+
+static struct attribute *cougar_attrs[] = {
+#ifdef COUGAR_LAYER
+	&cougar_attr_layer.attr,
+#endif
+#ifdef COUGAR_MODMAP
+	&cougar_attr_modmap.attr,
+#endif
+#ifdef COUGAR_DUAL_ROLE
+	&cougar_attr_dual_role.attr,
+#endif
+#ifdef COUGAR_MOUSEKEYS
+	&cougar_attr_mousekeys.attr,
+#endif
+#ifdef COUGAR_AGGREGATE
+	&cougar_attr_aggregate.attr,
+#endif
+	NULL
+};
+
+static const struct attribute_group cougar_attr_group = {
+	.attrs = cougar_attrs,
+};
+
+/*
+ * Per-interface files, added to the HID core's debugfs directory
+ */
+static void cougar_debugfs_init(struct hid_device *hdev, struct cougar *cougar)
+{
+	cougar_ring_debugfs_init(hdev, cougar);
+	cougar_inject_debugfs_init(hdev, cougar);
+	cougar_stats_debugfs_init(hdev, cougar);
+	cougar_storm_debugfs_init(hdev, cougar);
+}
+
+static void cougar_debugfs_exit(struct cougar *cougar)
+{
+	cougar_stats_debugfs_exit(cougar);
+	cougar_storm_debugfs_exit(cougar);
+	cougar_inject_debugfs_exit(cougar);
+	cougar_ring_debugfs_exit(cougar);
+}
+
+#ifdef COUGAR_KEYBOARD_HOOKS
+/* Largest array field decoded by the driver */
+#define COUGAR_KEYS_ARRAY_MAX	16
+
+/*
+ * Find the input reports made only of keys, which the driver decodes
+ * itself while keyboard hooks are enabled. Must be called once hid-input
+ * has mapped usages.
+ */
+static void cougar_keys_setup(struct hid_device *hdev, struct cougar *cougar)
+{
+	struct hid_report_enum *report_enum = &hdev->report_enum[HID_INPUT_REPORT];
+	struct hid_report *report;
+	struct hid_field *field;
+	unsigned int i, n;
+	bool keys;
+
+	list_for_each_entry(report, &report_enum->report_list, list) {
+		keys = report->maxfield > 0;
+		for (i = 0; keys && i < report->maxfield; i++) {
+			field = report->field[i];
+			if (field->flags & HID_MAIN_ITEM_VARIABLE)
+				keys = field->report_size == 1;
+			else
+				keys = field->report_count <= COUGAR_KEYS_ARRAY_MAX &&
+				       field->report_size <= 16;
+			keys = keys && field->hidinput &&
+			       field->logical_minimum >= 0;
+			for (n = 0; keys && n < field->maxusage; n++)
+				keys = !field->usage[n].type ||
+				       field->usage[n].type == EV_KEY;
+		}
+		if (!keys)
+			continue;
+
+		if (!cougar->key_reports)
+			cougar->key_reports = devm_kcalloc(&hdev->dev,
+							   BITS_TO_LONGS(HID_MAX_IDS),
+							   sizeof(unsigned long),
+							   GFP_KERNEL);
+		if (!cougar->key_reports)
+			return;
+		__set_bit(report->id, cougar->key_reports);
+	}
+}
+
+static inline bool cougar_keys_report(struct cougar *cougar,
+				      struct hid_report *report)
+{
+	return cougar->key_reports && test_bit(report->id, cougar->key_reports);
+}
+
+/* Report a key change of a decoded report, as hidinput_hid_event() */
+static void cougar_keys_event(struct cougar *cougar, bool hooks,
+			      struct hid_field *field, struct hid_usage *usage,
+			      s32 value)
+{
+	struct input_dev *input = field->hidinput->input;
+
+	if (usage->type != EV_KEY || !usage->code)
+		return;
+	if (hooks && cougar_keyboard_key(cougar->shared, input, usage->code,
+					 value))
+		return;
+	if (!!test_bit(usage->code, input->key) != value)
+		input_event(input, EV_MSC, MSC_SCAN, usage->hid);
+	input_event(input, EV_KEY, usage->code, value);
+}
+
+static bool cougar_keys_valid(struct hid_field *field, s32 value)
+{
+	return value >= field->logical_minimum &&
+	       value <= field->logical_maximum &&
+	       value - field->logical_minimum < field->maxusage;
+}
+
+static bool cougar_keys_find(const s32 *values, unsigned int count, s32 value)
+{
+	while (count--)
+		if (*values++ == value)
+			return true;
+	return false;
+}
+
+/* As hid_input_array_field(), ErrorRollOver included */
+static void cougar_keys_array(struct hid_device *hdev, struct cougar *cougar,
+			      bool hooks, struct hid_field *field, u8 *payload)
+{
+	unsigned int count = field->report_count, n;
+	s32 min = field->logical_minimum;
+	s32 value[COUGAR_KEYS_ARRAY_MAX];
+
+	for (n = 0; n < count; n++) {
+		value[n] = hid_field_extract(hdev, payload, field->report_offset +
+					     n * field->report_size,
+					     field->report_size);
+		if (cougar_keys_valid(field, value[n]) &&
+		    field->usage[value[n] - min].hid == HID_UP_KEYBOARD + 1)
+			return;
+	}
+
+	for (n = 0; n < count; n++) {
+		if (cougar_keys_valid(field, field->value[n]) &&
+		    !cougar_keys_find(value, count, field->value[n]))
+			cougar_keys_event(cougar, hooks, field,
+					  &field->usage[field->value[n] - min], 0);
+		if (cougar_keys_valid(field, value[n]) &&
+		    !cougar_keys_find(field->value, count, value[n]))
+			cougar_keys_event(cougar, hooks, field,
+					  &field->usage[value[n] - min], 1);
+	}
+	memcpy(field->value, value, count * sizeof(*value));
+}
+
+/*
+ * Decode a report made only of keys as hid-core would, with the changed
+ * keys going through the keyboard hooks, instead of having hid-core call
+ * the driver back for every usage of every report. Field values are kept
+ * up to date, so that hid-core carries on from them once hooks are
+ * disabled.
+ */
+static int cougar_keys_decode(struct hid_device *hdev, struct cougar *cougar,
+			      struct hid_report *report, u8 *data, int size)
+{
+	unsigned int numbered = hdev->report_enum[HID_INPUT_REPORT].numbered ? 1 : 0;
+	struct hid_input *hidinput;
+	struct hid_field *field;
+	unsigned int i, n;
+	u8 *payload;
+	bool hooks;
+	s32 value;
+
+	if (size < numbered + DIV_ROUND_UP(report->size, 8))
+		return 0;
+	payload = data + numbered;
+
+	/* See cougar_remove() */
+	rcu_read_lock();
+	hooks = cougar->shared && READ_ONCE(cougar->shared->enabled);
+	for (i = 0; i < report->maxfield; i++) {
+		field = report->field[i];
+		if (!(field->flags & HID_MAIN_ITEM_VARIABLE)) {
+			cougar_keys_array(hdev, cougar, hooks, field, payload);
+			continue;
+		}
+		for (n = 0; n < min(field->report_count, field->maxusage); n++) {
+			value = hid_field_extract(hdev, payload,
+						  field->report_offset + n, 1);
+			if (value == field->value[n])
+				continue;
+			field->value[n] = value;
+			cougar_keys_event(cougar, hooks, field,
+					  &field->usage[n], value);
+		}
+	}
+	rcu_read_unlock();
+
+	/* As hidinput_report_event() */
+	list_for_each_entry(hidinput, &hdev->inputs, list)
+		input_sync(hidinput->input);
+
+	if (hdev->claimed & HID_CLAIMED_HIDRAW)
+		hidraw_report_event(hdev, data, size);
+	return COUGAR_REPORT_CONSUMED;
+}
+#else
+static inline void cougar_keys_setup(struct hid_device *hdev,
+				     struct cougar *cougar)
+{
+}
+
+static inline bool cougar_keys_report(struct cougar *cougar,
+				      struct hid_report *report)
+{
+	return false;
+}
+
+static inline int cougar_keys_decode(struct hid_device *hdev,
+				     struct cougar *cougar,
+				     struct hid_report *report, u8 *data,
+				     int size)
+{
+	return 0;
+}
+#endif
+
+static int cougar_probe(struct hid_device *hdev,
+			const struct hid_device_id *id)
+{
+	struct cougar_probe_times t = { 0 };
+	struct cougar *cougar;
+	struct hid_input *next, *hidinput = NULL;
+	unsigned int connect_mask;
+	ktime_t phase;
+	int error;
+
+	t.start = ktime_get();
+	error = hid_parse(hdev);
+	if (error) {
+		hid_err(hdev, "parse failed\n");
+		return error;
+	}
+	phase = ktime_get();
+	t.parse = ktime_to_ns(ktime_sub(phase, t.start));
+
+	/* The interface's state must be in place before it can get reports */
+	cougar = cougar_bind_shared_data(hdev, &t);
+	if (IS_ERR(cougar))
+		return PTR_ERR(cougar);
+	t.bind = ktime_to_ns(ktime_sub(ktime_get(), phase));
+	cougar_stats_probe(cougar, &t);
+	hid_set_drvdata(hdev, cougar);
+
+	if (hdev->collection->usage == COUGAR_VENDOR_USAGE) {
+		cougar->special_intf = true;
+		connect_mask = HID_CONNECT_HIDRAW;
+	} else
+		connect_mask = HID_CONNECT_DEFAULT;
+
+	phase = ktime_get();
+	error = hid_hw_start(hdev, connect_mask);
+	if (error) {
+		hid_err(hdev, "hw start failed\n");
+		goto fail;
+	}
+	t.hw_start = ktime_to_ns(ktime_sub(ktime_get(), phase));
+
+	if (!cougar->special_intf)
+		cougar_keys_setup(hdev, cougar);
+	if (hdev->collection->usage == HID_GD_KEYBOARD)
+		cougar_nkro_setup(hdev, cougar);
+
+	error = sysfs_create_group(&hdev->dev.kobj, &cougar_attr_group);
+	if (error)
+		goto fail;
+
+	/* The custom vendor interface will use the hid_input registered
+	 * for the keyboard interface, in order to send translated key codes
+	 * to it.
+	 */
+	if (hdev->collection->usage == HID_GD_KEYBOARD) {
+		hid_info(hdev, "G6 mapped to %s\n",
+			 READ_ONCE(cougar_g6_is_space) ? "space" : "F18");
+		list_for_each_entry_safe(hidinput, next, &hdev->inputs, list) {
+			if (hidinput->registered && hidinput->input != NULL) {
+				mutex_lock(&cougar_udev_list_lock);
+				cougar->shared->input = hidinput->input;
+				cougar_update_keybits(cougar->shared);
+				mutex_unlock(&cougar_udev_list_lock);
+				WRITE_ONCE(cougar->shared->enabled, true);
+				break;
+			}
+		}
+	} else if (hdev->collection->usage == COUGAR_VENDOR_USAGE) {
+		phase = ktime_get();
+		error = hid_hw_open(hdev);
+		if (error)
+			goto fail_remove_attr;
+		t.open = ktime_to_ns(ktime_sub(ktime_get(), phase));
+	}
+
+	cougar_debugfs_init(hdev, cougar);
+	t.total = ktime_to_ns(ktime_sub(ktime_get(), t.start));
+	cougar_stats_probe(cougar, &t);
+	return 0;
+
+fail_remove_attr:
+	sysfs_remove_group(&hdev->dev.kobj, &cougar_attr_group);
+fail:
+	/*
+	 * Before hid_hw_stop() unregisters the input it repeats on, and even
+	 * if hid_hw_start() failed, as it may have configured the inputs
+	 */
+	cougar_repeat_stop(cougar);
+	cougar_nkro_exit(cougar);
+	/* Only a started device has claimed an input, hidraw or hiddev */
+	if (hdev->claimed)
+		hid_hw_stop(hdev);
+	hid_set_drvdata(hdev, NULL);
+	return error;
+}
+
+/*
+ * Run a key event of the keyboard intf through the active layer, the
+ * event ring and dual-role keys. Returns true if it was consumed or
+ * emitted here, false if it must be reported as is.
+ */
+bool cougar_keyboard_key(struct cougar_shared *shared, struct input_dev *input,
+			 unsigned int code, s32 value)
+{
+	unsigned int orig = code;
+
+	if (cougar_layer_active()) {
+		rcu_read_lock();
+		code = cougar_layer_resolve(shared, input, code, value);
+		rcu_read_unlock();
+	}
+
+	if (cougar_ring_active() && !!test_bit(code, input->key) != !!value)
+		cougar_ring_push(shared, COUGAR_RING_SRC_KEYBOARD, code, value);
+
+	if (cougar_dual_active() &&
+	    cougar_dual_event(shared, input, code, value))
+		return true;
+
+	if (code == orig) {
+		/* hid-input reports it, only the aggregate and repeat need it */
+		if (cougar_aggregate_active())
+			cougar_aggregate_event(shared, code, value);
+		if (cougar_repeat_active())
+			cougar_repeat_event(shared, input, code, value);
+		return false;
+	}
+
+	cougar_key(shared, input, code, value);
+	return true;
+}
+
+/*
+ * Convert events from vendor intf to input key events, and decode those
+ * of the other intfs that the driver handles itself
+ */
+static int cougar_raw_event(struct hid_device *hdev, struct hid_report *report,
+			    u8 *data, int size)
+{
+	struct cougar *cougar;
+	struct input_dev *input;
+	unsigned char code, action;
+	unsigned int keycode = 0;
+	int i;
+
+	cougar = hid_get_drvdata(hdev);
+	if (cougar_stats_active())
+		cougar_stats_account(cougar, data, size);
+
+	if (cougar_nkro_report(cougar, report))
+		return cougar_nkro_decode(hdev, cougar, data, size);
+
+	if (cougar_keyboard_hooks() && cougar_keys_report(cougar, report))
+		return cougar_keys_decode(hdev, cougar, report, data, size);
+
+	if (!cougar->special_intf || !cougar->shared ||
+	    !READ_ONCE(cougar->shared->enabled))
+		return 0;
+
+	if (cougar_stats_active())
+		cougar_stats_accepted(cougar);
+
+	/*
+	 * Only press and release are taken from the firmware: repeats come
+	 * from the driver or the input core, like for any other key.
+	 */
+	code = data[COUGAR_FIELD_CODE];
+	action = !!data[COUGAR_FIELD_ACTION];
+	if (cougar_storm_active() &&
+	    cougar_storm_throttle(hdev, cougar, code, action))
+		return COUGAR_REPORT_THROTTLED;
+
+	if (cougar_layer_active() &&
+	    cougar_layer_shift(cougar->shared, code, action))
+		return 0;
+
+	if (cougar_mouse_active() &&
+	    cougar_mouse_event(cougar->shared, code, action))
+		return 0;
+
+	/*
+	 * Up to the emitted event, see cougar_g6_is_space_set() and
+	 * cougar_remove()
+	 */
+	rcu_read_lock();
+	input = READ_ONCE(cougar->shared->input);
+	if (!input || !READ_ONCE(cougar->shared->enabled))
+		goto out;
+	if (cougar_modmap_active())
+		keycode = cougar_modmap_resolve(cougar->shared, input, code,
+						action);
+
+	for (i = 0; !keycode && cougar_mapping[i][0]; i++) {
+		if (code == cougar_mapping[i][0]) {
+			keycode = READ_ONCE(cougar_mapping[i][1]);
+			if (code != COUGAR_KEY_G6)
+				break;
+			/* Release what G6 pressed, unless the switch did */
+			if (action)
+				WRITE_ONCE(cougar->shared->g6_key, keycode);
+			else
+				keycode = xchg(&cougar->shared->g6_key, 0) ?:
+					  keycode;
+			break;
+		}
+	}
+	if (!keycode) {
+		hid_warn_ratelimited(hdev, "unmapped special key code %x: ignoring\n",
+				     code);
+		goto out;
+	}
+
+	if (cougar_ring_active())
+		cougar_ring_push(cougar->shared, COUGAR_RING_SRC_VENDOR,
+				 keycode, action);
+
+	if (cougar_dual_active() &&
+	    cougar_dual_event(cougar->shared, input, keycode, action))
+		goto out;
+
+	cougar_key(cougar->shared, input, keycode, action);
+	input_sync(input);
+out:
+	rcu_read_unlock();
+	return 0;
+}
+
+
+static int cougar_input_configured(struct hid_device *hdev,
+				   struct hid_input *hidinput)
+{
+	struct cougar *cougar = hid_get_drvdata(hdev);
+
+	if (hdev->collection->usage != HID_GD_KEYBOARD)
+		return 0;
+
+	cougar_set_keybits(hidinput->input);
+	if (cougar)
+		cougar_repeat_start(cougar, hidinput->input);
+	return 0;
+}
+
+/*
+ * Stop the group's event hooks, and forget its keyboard input when its
+ * intf goes away, along with the keys it holds on the aggregated
+ * keyboard. Reports check 'enabled' and use the input under
+ * rcu_read_lock(), everything else uses the input under
+ * cougar_udev_list_lock, so none can reach either once this returns.
+ */
+static void cougar_disable_shared(struct cougar_shared *shared,
+				  struct hid_device *hdev)
+{
+	bool dropped = false;
+
+	mutex_lock(&cougar_udev_list_lock);
+	WRITE_ONCE(shared->enabled, false);
+	if (shared->input && input_get_drvdata(shared->input) == hdev) {
+		WRITE_ONCE(shared->input, NULL);
+		dropped = true;
+	}
+	mutex_unlock(&cougar_udev_list_lock);
+	synchronize_rcu();
+
+	if (dropped)
+		cougar_aggregate_release(shared);
+}
+
+static void cougar_remove(struct hid_device *hdev)
+{
+	struct cougar *cougar = hid_get_drvdata(hdev);
+
+	if (cougar) {
+		cougar_debugfs_exit(cougar);
+		cougar_nkro_exit(cougar);
+		sysfs_remove_group(&hdev->dev.kobj, &cougar_attr_group);
+		if (cougar->shared)
+			cougar_disable_shared(cougar->shared, hdev);
+		if (cougar->special_intf)
+			hid_hw_close(hdev);
+		/*
+		 * No report can queue dual-role keys or arm their timer any
+		 * more: release the held ones. They were all pressed on the
+		 * keyboard intf's input, which is still registered here: when
+		 * this is the keyboard intf, it only goes away in hid_hw_stop()
+		 * below.
+		 */
+		if (cougar->shared)
+			cougar_dual_release(cougar->shared);
+		cougar_repeat_stop(cougar);
+	}
+	hid_hw_stop(hdev);
+}
+
+static struct hid_device_id cougar_id_table[] = {
+	{ HID_USB_DEVICE(USB_VENDOR_ID_SOLID_YEAR,
+			 USB_DEVICE_ID_COUGAR_700K_GAMING_KEYBOARD) },
+	{}
+};
+MODULE_DEVICE_TABLE(hid, cougar_id_table);
+
+static struct hid_driver cougar_driver = {
+	.name			= "cougar",
+	.id_table		= cougar_id_table,
+	.report_fixup		= cougar_report_fixup,
+	.probe			= cougar_probe,
+	.remove			= cougar_remove,
+	.raw_event		= cougar_raw_event,
+	.input_configured	= cougar_input_configured,
+};
+
+module_hid_driver(cougar_driver);
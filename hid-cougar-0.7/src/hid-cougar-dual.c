@@ -0,0 +1,394 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: tap-hold dual-role keys
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static unsigned int cougar_tap_hold_us = 200000;
+module_param_named(tap_hold_us, cougar_tap_hold_us, uint, 0600);
+MODULE_PARM_DESC(tap_hold_us,
+	"Time after which a held dual-role key acts as its hold key, in us (default=200000)");
+
+DEFINE_STATIC_KEY_FALSE(cougar_dual_key);
+
+/*
+ * Replay the events queued while a dual-role key was pending.
+ * Must be called with ds->lock held, as all cougar_dual_* helpers.
+ */
+static void cougar_dual_flush(struct cougar_dual_state *ds)
+{
+	struct cougar_shared *shared = ds->shared;
+	unsigned int i;
+
+	for (i = 0; i < ds->queued; i++) {
+		cougar_key(shared, ds->queue[i].input, ds->queue[i].code,
+			   ds->queue[i].value);
+		input_sync(ds->queue[i].input);
+	}
+	ds->queued = 0;
+}
+
+static void cougar_dual_resolve(struct cougar_dual_state *ds, bool hold)
+{
+	struct cougar_shared *shared = ds->shared;
+	struct input_dev *input = ds->input;
+
+	/*
+	 * Keys held through a table being replaced still count until
+	 * cougar_dual_role_update() resets them: once full, tap instead
+	 */
+	if (ds->held == COUGAR_DUAL_ROLE_MAX)
+		hold = false;
+
+	ds->pending = false;
+	if (hold) {
+		ds->holding[ds->held].input = input;
+		ds->holding[ds->held].code = ds->key.code;
+		ds->holding[ds->held].hold = ds->key.hold;
+		ds->held++;
+		cougar_key(shared, input, ds->key.hold, 1);
+	} else {
+		cougar_key(shared, input, ds->key.tap, 1);
+		input_sync(input);
+		cougar_key(shared, input, ds->key.tap, 0);
+	}
+	input_sync(input);
+	cougar_dual_flush(ds);
+}
+
+static enum hrtimer_restart cougar_dual_timeout(struct hrtimer *timer)
+{
+	struct cougar_dual_state *ds = container_of(timer,
+						    struct cougar_dual_state,
+						    timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	/* A new key may have become pending since this expiry was armed */
+	if (ds->pending && ktime_compare(ktime_get(), ds->deadline) >= 0)
+		cougar_dual_resolve(ds, true);
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+static bool cougar_dual_key_event(struct cougar_dual_state *ds,
+				  struct input_dev *input,
+				  const struct cougar_dual_role_key *key,
+				  s32 value)
+{
+	struct cougar_shared *shared = ds->shared;
+	unsigned int i;
+
+	for (i = 0; i < ds->held; i++) {
+		if (ds->holding[i].code != key->code)
+			continue;
+		if (!value) {
+			cougar_key(shared, ds->holding[i].input,
+				   ds->holding[i].hold, 0);
+			input_sync(ds->holding[i].input);
+			ds->holding[i] = ds->holding[--ds->held];
+		}
+		return true;
+	}
+
+	if (ds->pending && ds->key.code == key->code) {
+		if (!value) {
+			hrtimer_try_to_cancel(&ds->timer);
+			cougar_dual_resolve(ds, false);
+		}
+		return true;
+	}
+
+	/* Not tracked: pressed before it was configured as dual-role */
+	if (!value)
+		return false;
+
+	/* Another dual-role key settles the pending one as a modifier */
+	if (ds->pending)
+		cougar_dual_resolve(ds, true);
+
+	ds->pending = true;
+	ds->key = *key;
+	ds->input = input;
+	ds->deadline = ktime_add_us(ktime_get(), cougar_tap_hold_us);
+	hrtimer_start(&ds->timer, ds->deadline, HRTIMER_MODE_ABS);
+	return true;
+}
+
+static bool cougar_dual_other_event(struct cougar_dual_state *ds,
+				    struct input_dev *input,
+				    unsigned int code, s32 value)
+{
+	int i, last = -1;
+
+	for (i = 0; i < ds->queued; i++)
+		if (ds->queue[i].code == code)
+			last = i;
+
+	if (value) {
+		/* Variable fields repeat the state of held keys every report */
+		if (last >= 0 && ds->queue[last].value)
+			return true;
+		if (last < 0 && test_bit(code, input->key))
+			return false;
+
+		if (ds->queued == COUGAR_DUAL_ROLE_QUEUE) {
+			cougar_dual_resolve(ds, true);
+			return false;
+		}
+		ds->queue[ds->queued].input = input;
+		ds->queue[ds->queued].code = code;
+		ds->queue[ds->queued].value = value;
+		ds->queued++;
+		return true;
+	}
+
+	/* Released a key pressed before the dual-role key */
+	if (last < 0)
+		return false;
+
+	/* A key tapped while the dual-role key is down: it is a modifier */
+	hrtimer_try_to_cancel(&ds->timer);
+	cougar_dual_resolve(ds, true);
+	return false;
+}
+
+/*
+ * Feed a key event of either intf through the dual-role state machine.
+ * Returns true if it was consumed (emitted, queued or swallowed) and
+ * must not be reported as is.
+ */
+bool cougar_dual_event(struct cougar_shared *shared, struct input_dev *input,
+		       unsigned int code, s32 value)
+{
+	struct cougar_dual_state *ds = READ_ONCE(shared->dual);
+	struct cougar_dual_role_key key = { 0 };
+	struct cougar_dual_role *dual;
+	unsigned long flags;
+	unsigned int i;
+	bool consumed;
+
+	/* Other groups' dual-role keys are enabled, not this one's */
+	if (!ds)
+		return false;
+
+	rcu_read_lock();
+	dual = rcu_dereference(shared->dual_role);
+	for (i = 0; dual && i < dual->count; i++) {
+		if (dual->keys[i].code == code) {
+			key = dual->keys[i];
+			break;
+		}
+	}
+	rcu_read_unlock();
+
+	if (!key.code && !READ_ONCE(ds->pending))
+		return false;
+
+	spin_lock_irqsave(&ds->lock, flags);
+	if (key.code)
+		consumed = cougar_dual_key_event(ds, input, &key, value);
+	else if (ds->pending)
+		consumed = cougar_dual_other_event(ds, input, code, value);
+	else
+		consumed = false;
+	spin_unlock_irqrestore(&ds->lock, flags);
+
+	return consumed;
+}
+
+/*
+ * Advertise the codes of the group's dual-role keys. Must be called with
+ * cougar_udev_list_lock held.
+ */
+void cougar_dual_keybits(struct cougar_shared *shared)
+{
+	struct cougar_dual_role *dual;
+	unsigned int i;
+
+	dual = rcu_dereference_protected(shared->dual_role,
+					 lockdep_is_held(&cougar_udev_list_lock));
+	for (i = 0; dual && i < dual->count; i++) {
+		input_set_capability(shared->input, EV_KEY, dual->keys[i].tap);
+		input_set_capability(shared->input, EV_KEY, dual->keys[i].hold);
+	}
+}
+
+/*
+ * Give the group its dual-role state when first configured. Must be
+ * called with cougar_udev_list_lock held.
+ */
+static int cougar_dual_alloc(struct cougar_shared *shared)
+{
+	struct cougar_dual_state *ds;
+
+	if (shared->dual)
+		return 0;
+
+	ds = kzalloc(sizeof(*ds), GFP_KERNEL);
+	if (!ds)
+		return -ENOMEM;
+	ds->shared = shared;
+	spin_lock_init(&ds->lock);
+	hrtimer_setup(&ds->timer, cougar_dual_timeout, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+	/* Before the table that lets events reach it */
+	smp_store_release(&shared->dual, ds);
+	return 0;
+}
+
+/*
+ * Forget any pending decision and held keys; with 'release', held keys
+ * are released first (their input devices must still be registered).
+ */
+static void cougar_dual_reset(struct cougar_dual_state *ds, bool release)
+{
+	struct cougar_shared *shared = ds->shared;
+	unsigned long flags;
+	unsigned int i;
+
+	hrtimer_cancel(&ds->timer);
+
+	spin_lock_irqsave(&ds->lock, flags);
+	for (i = 0; release && i < ds->held; i++) {
+		cougar_key(shared, ds->holding[i].input, ds->holding[i].hold, 0);
+		input_sync(ds->holding[i].input);
+	}
+	ds->pending = false;
+	ds->held = 0;
+	ds->queued = 0;
+	spin_unlock_irqrestore(&ds->lock, flags);
+}
+
+/*
+ * Release the held dual-role keys of a group no report can reach any
+ * more, see cougar_remove()
+ */
+void cougar_dual_release(struct cougar_shared *shared)
+{
+	if (shared->dual)
+		cougar_dual_reset(shared->dual, true);
+}
+
+/* Free the dual-role keys of a group no interface uses any more */
+void cougar_dual_exit(struct cougar_shared *shared)
+{
+	if (shared->dual) {
+		hrtimer_cancel(&shared->dual->timer);
+		kfree(shared->dual);
+	}
+	if (rcu_access_pointer(shared->dual_role)) {
+		static_branch_dec(&cougar_dual_key);
+		kfree(rcu_dereference_protected(shared->dual_role, true));
+	}
+}
+
+static int cougar_dual_role_update(struct cougar_shared *shared,
+				   struct cougar_dual_role *dual)
+{
+	struct cougar_dual_role *old;
+	int error;
+
+	mutex_lock(&cougar_udev_list_lock);
+	error = dual ? cougar_dual_alloc(shared) : 0;
+	if (error) {
+		mutex_unlock(&cougar_udev_list_lock);
+		return error;
+	}
+	old = rcu_dereference_protected(shared->dual_role,
+					lockdep_is_held(&cougar_udev_list_lock));
+	rcu_assign_pointer(shared->dual_role, dual);
+	if (!old && dual)
+		static_branch_inc(&cougar_dual_key);
+	else if (old && !dual)
+		static_branch_dec(&cougar_dual_key);
+	cougar_update_keybits(shared);
+	mutex_unlock(&cougar_udev_list_lock);
+
+	if (!old)
+		return 0;
+
+	synchronize_rcu();
+	cougar_dual_reset(shared->dual, true);
+	kfree(old);
+	return 0;
+}
+
+/*
+ * sysfs "dual_role": up to COUGAR_DUAL_ROLE_MAX "<code>:<tap>:<hold>" key
+ * codes, e.g. "58:1:29" for CapsLock as Esc when tapped, Ctrl when held.
+ * Codes are the ones reported after translation and layers, so G1 is 183
+ * (F13). An empty string removes all dual-role keys.
+ */
+static ssize_t dual_role_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_dual_role *dual;
+	ssize_t len = 0;
+	unsigned int i;
+
+	rcu_read_lock();
+	dual = rcu_dereference(cougar->shared->dual_role);
+	for (i = 0; dual && i < dual->count; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s%u:%u:%u",
+				 i ? " " : "", dual->keys[i].code,
+				 dual->keys[i].tap, dual->keys[i].hold);
+	rcu_read_unlock();
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static ssize_t dual_role_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_dual_role *dual = NULL;
+	int code, tap, hold;
+	char *args, *p, *tok;
+	int error = -EINVAL;
+
+	args = kstrndup(buf, count, GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	p = strim(args);
+	if (*p) {
+		dual = kzalloc(sizeof(*dual), GFP_KERNEL);
+		if (!dual) {
+			error = -ENOMEM;
+			goto out_free;
+		}
+		while ((tok = strsep(&p, " ")) != NULL) {
+			if (!*tok)
+				continue;
+			if (dual->count == COUGAR_DUAL_ROLE_MAX ||
+			    sscanf(tok, "%i:%i:%i", &code, &tap, &hold) != 3 ||
+			    code <= 0 || code >= KEY_CNT ||
+			    tap <= 0 || tap >= KEY_CNT ||
+			    hold <= 0 || hold >= KEY_CNT)
+				goto out_free;
+			dual->keys[dual->count].code = code;
+			dual->keys[dual->count].tap = tap;
+			dual->keys[dual->count].hold = hold;
+			dual->count++;
+		}
+	}
+
+	error = cougar_dual_role_update(cougar->shared, dual);
+	if (error)
+		goto out_free;
+	kfree(args);
+	return count;
+
+out_free:
+	kfree(dual);
+	kfree(args);
+	return error;
+}
+struct device_attribute cougar_attr_dual_role = __ATTR_RW(dual_role);
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: synthetic report injection
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+/*
+ * Synthetic report injection through debugfs, for benchmarking.
+ *
+ * Writing "<count> <rate> <byte> <byte>..." to "cougar_inject" feeds the
+ * given report (hex bytes, report ID included if numbered) 'count' times
+ * to hid_input_report(), the function usbhid and uhid hand reports to,
+ * at 'rate' reports per second (0=as fast as possible). Reading the file
+ * returns the results of the last run. Reports refused because the
+ * device was busy with a real one are counted as dropped, and those the
+ * storm throttle rejected as throttled.
+ */
+static ssize_t cougar_inject_write(struct file *file, const char __user *ubuf,
+				   size_t count, loff_t *ppos)
+{
+	struct hid_device *hdev = file->private_data;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_inject_stats stats = { 0 }, *last;
+	unsigned long n, rate;
+	u8 report[64], *data;
+	char *buf, *p, *tok;
+	unsigned int size = 0;
+	u64 start, now, due;
+	int error, ret;
+
+	if (!cougar)
+		return -ENODEV;
+
+	buf = memdup_user_nul(ubuf, min_t(size_t, count, PAGE_SIZE));
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	p = strim(buf);
+	error = -EINVAL;
+	tok = strsep(&p, " ");
+	if (!tok || kstrtoul(tok, 0, &n) || !n)
+		goto out_free;
+	tok = strsep(&p, " ");
+	if (!tok || kstrtoul(tok, 0, &rate))
+		goto out_free;
+	while ((tok = strsep(&p, " ")) != NULL) {
+		if (!*tok)
+			continue;
+		if (size == sizeof(report) || kstrtou8(tok, 16, &report[size]))
+			goto out_free;
+		size++;
+	}
+	if (!size)
+		goto out_free;
+
+	/* Results are kept from the first run on */
+	error = -ENOMEM;
+	if (!READ_ONCE(cougar->inject)) {
+		last = kzalloc(sizeof(*last), GFP_KERNEL);
+		if (!last)
+			goto out_free;
+		if (cmpxchg(&cougar->inject, NULL, last))
+			kfree(last);
+	}
+
+	/* hid_report_raw_event() may zero-pad the report up to its full size */
+	data = kmalloc(HID_MAX_BUFFER_SIZE, GFP_KERNEL);
+	if (!data)
+		goto out_free;
+
+	start = ktime_get_ns();
+	for (stats.reports = 0; stats.reports < n; stats.reports++) {
+		memcpy(data, report, size);
+		ret = hid_input_report(hdev, HID_INPUT_REPORT, data, size, 1);
+		if (ret == -EBUSY)
+			stats.dropped++;
+		else if (ret == COUGAR_REPORT_THROTTLED)
+			stats.throttled++;
+
+		if ((stats.reports & 1023) == 1023) {
+			if (signal_pending(current) || READ_ONCE(cougar->removing))
+				break;
+			cond_resched();
+		}
+		if (rate) {
+			due = start + div_u64((stats.reports + 1) * NSEC_PER_SEC,
+					      rate);
+			now = ktime_get_ns();
+			if (due > now + 50 * NSEC_PER_USEC)
+				usleep_range(div_u64(due - now, NSEC_PER_USEC),
+					     div_u64(due - now, NSEC_PER_USEC) + 50);
+		}
+	}
+	stats.elapsed_ns = ktime_get_ns() - start;
+	*cougar->inject = stats;
+
+	kfree(data);
+	error = count;
+out_free:
+	kfree(buf);
+	return error;
+}
+
+static ssize_t cougar_inject_read(struct file *file, char __user *ubuf,
+				  size_t count, loff_t *ppos)
+{
+	struct hid_device *hdev = file->private_data;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_inject_stats stats = { 0 }, *last;
+	char buf[192];
+	int len;
+
+	if (!cougar)
+		return -ENODEV;
+
+	last = READ_ONCE(cougar->inject);
+	if (last)
+		stats = *last;
+	len = scnprintf(buf, sizeof(buf),
+			"reports %llu\ndropped %llu\nthrottled %llu\nelapsed_ns %llu\nns_per_report %llu\n",
+			stats.reports, stats.dropped, stats.throttled,
+			stats.elapsed_ns,
+			stats.reports ? div64_u64(stats.elapsed_ns, stats.reports) : 0);
+	return simple_read_from_buffer(ubuf, count, ppos, buf, len);
+}
+
+static const struct file_operations cougar_inject_fops = {
+	.owner		= THIS_MODULE,
+	.open		= simple_open,
+	.read		= cougar_inject_read,
+	.write		= cougar_inject_write,
+	.llseek		= default_llseek,
+};
+
+void cougar_inject_debugfs_init(struct hid_device *hdev, struct cougar *cougar)
+{
+	cougar->debug_inject = debugfs_create_file("cougar_inject", 0600,
+						   hdev->debug_dir, hdev,
+						   &cougar_inject_fops);
+}
+
+void cougar_inject_debugfs_exit(struct cougar *cougar)
+{
+	/* Abort any running injection before waiting for it to finish */
+	WRITE_ONCE(cougar->removing, true);
+	debugfs_remove(cougar->debug_inject);
+}
+
+/* Free the results of an interface whose slot is being released */
+void cougar_inject_unbind(struct cougar *cougar)
+{
+	kfree(cougar->inject);
+	cougar->inject = NULL;
+}
@@ -0,0 +1,198 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: momentary layer
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+DEFINE_STATIC_KEY_FALSE(cougar_layer_key);
+
+/*
+ * Shift the layer in or out if 'code' is its shift key
+ */
+bool cougar_layer_shift(struct cougar_shared *shared, unsigned char code,
+			unsigned char action)
+{
+	struct cougar_layer *layer;
+	bool shift;
+
+	rcu_read_lock();
+	layer = rcu_dereference(shared->layer_map);
+	shift = layer && layer->shift_code == code;
+	if (shift)
+		WRITE_ONCE(shared->shifted, action);
+	rcu_read_unlock();
+	return shift;
+}
+
+/*
+ * Translate a keyboard intf key through the active layer. Keys pressed
+ * while shifted keep their layer code until released, even if the layer
+ * key is released first. Only new presses are layered: hid-core reports
+ * keys of variable fields (the modifiers) again with every report, and a
+ * key already down keeps its own code. Must be called under
+ * rcu_read_lock().
+ */
+unsigned int cougar_layer_resolve(struct cougar_shared *shared,
+				  struct input_dev *input, unsigned int code,
+				  __s32 value)
+{
+	struct cougar_layer *layer;
+
+	layer = rcu_dereference(shared->layer_map);
+	if (!layer)
+		return code;
+
+	if (test_bit(code, layer->layered)) {
+		if (!value)
+			clear_bit(code, layer->layered);
+		return layer->map[code];
+	}
+
+	if (value && READ_ONCE(shared->shifted) && layer->map[code] != code &&
+	    !test_bit(code, input->key)) {
+		set_bit(code, layer->layered);
+		return layer->map[code];
+	}
+	return code;
+}
+
+/*
+ * Advertise the codes of the group's layer. Must be called with
+ * cougar_udev_list_lock held.
+ */
+void cougar_layer_keybits(struct cougar_shared *shared)
+{
+	struct cougar_layer *layer;
+	unsigned int code;
+
+	layer = rcu_dereference_protected(shared->layer_map,
+					  lockdep_is_held(&cougar_udev_list_lock));
+	for (code = 0; layer && code < KEY_CNT; code++)
+		if (layer->map[code] != code)
+			input_set_capability(shared->input, EV_KEY,
+					     layer->map[code]);
+}
+
+/*
+ * Install a new layer (or none), releasing keys held through the old one
+ */
+static void cougar_layer_update(struct cougar_shared *shared,
+				struct cougar_layer *layer)
+{
+	struct cougar_layer *old;
+	unsigned int code;
+
+	mutex_lock(&cougar_udev_list_lock);
+	old = rcu_dereference_protected(shared->layer_map,
+					lockdep_is_held(&cougar_udev_list_lock));
+	WRITE_ONCE(shared->shifted, false);
+	rcu_assign_pointer(shared->layer_map, layer);
+	if (!old && layer)
+		static_branch_inc(&cougar_layer_key);
+	else if (old && !layer)
+		static_branch_dec(&cougar_layer_key);
+	cougar_update_keybits(shared);
+	mutex_unlock(&cougar_udev_list_lock);
+
+	if (!old)
+		return;
+
+	synchronize_rcu();
+	mutex_lock(&cougar_udev_list_lock);
+	if (shared->input) {
+		for_each_set_bit(code, old->layered, KEY_CNT)
+			cougar_key(shared, shared->input, old->map[code], 0);
+		input_sync(shared->input);
+	}
+	mutex_unlock(&cougar_udev_list_lock);
+	kfree(old);
+}
+
+/* Free the layer of a group no interface uses any more */
+void cougar_layer_exit(struct cougar_shared *shared)
+{
+	if (rcu_access_pointer(shared->layer_map)) {
+		static_branch_dec(&cougar_layer_key);
+		kfree(rcu_dereference_protected(shared->layer_map, true));
+	}
+}
+
+/*
+ * sysfs "layer": "<shift code> <from>:<to>...", vendor code and key codes
+ * in any base, e.g. "0x78 17:103 30:105 31:108 32:106" turns WASD into
+ * arrows while G6 is held. An empty string removes the layer.
+ */
+static ssize_t layer_show(struct device *dev, struct device_attribute *attr,
+			  char *buf)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_layer *layer;
+	unsigned int code;
+	ssize_t len = 0;
+
+	rcu_read_lock();
+	layer = rcu_dereference(cougar->shared->layer_map);
+	if (layer) {
+		len = scnprintf(buf, PAGE_SIZE, "0x%02x", layer->shift_code);
+		for (code = 0; code < KEY_CNT; code++)
+			if (layer->map[code] != code)
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 " %u:%u", code,
+						 layer->map[code]);
+	}
+	rcu_read_unlock();
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static ssize_t layer_store(struct device *dev, struct device_attribute *attr,
+			   const char *buf, size_t count)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_layer *layer = NULL;
+	char *args, *p, *tok;
+	unsigned int code;
+	int from, to;
+	int error = -EINVAL;
+
+	args = kstrndup(buf, count, GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	p = strim(args);
+	if (*p) {
+		layer = kzalloc(sizeof(*layer), GFP_KERNEL);
+		if (!layer) {
+			error = -ENOMEM;
+			goto out_free;
+		}
+		for (code = 0; code < KEY_CNT; code++)
+			layer->map[code] = code;
+
+		tok = strsep(&p, " ");
+		if (kstrtou8(tok, 0, &layer->shift_code))
+			goto out_free;
+		while ((tok = strsep(&p, " ")) != NULL) {
+			if (!*tok)
+				continue;
+			if (sscanf(tok, "%i:%i", &from, &to) != 2 ||
+			    from < 0 || from >= KEY_CNT ||
+			    to < 0 || to >= KEY_CNT)
+				goto out_free;
+			layer->map[from] = to;
+		}
+	}
+
+	cougar_layer_update(cougar->shared, layer);
+	kfree(args);
+	return count;
+
+out_free:
+	kfree(layer);
+	kfree(args);
+	return error;
+}
+struct device_attribute cougar_attr_layer = __ATTR_RW(layer);
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: modifier-aware G-key table
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+DEFINE_STATIC_KEY_FALSE(cougar_modmap_key);
+
+static const char * const cougar_mod_names[COUGAR_MOD_CLASSES] = {
+	[COUGAR_MOD_NONE]	= "none",
+	[COUGAR_MOD_SHIFT]	= "shift",
+	[COUGAR_MOD_CTRL]	= "ctrl",
+	[COUGAR_MOD_ALT]	= "alt",
+	[COUGAR_MOD_ALTGR]	= "altgr",
+	[COUGAR_MOD_META]	= "meta",
+};
+
+/*
+ * Modifier class from the keyboard intf's key state, which the input core
+ * keeps up to date. With several modifiers held, the first of Ctrl, Alt,
+ * AltGr, Meta and Shift wins.
+ */
+static unsigned int cougar_mod_class(struct input_dev *input)
+{
+	const unsigned long *key = input->key;
+
+	if (test_bit(KEY_LEFTCTRL, key) || test_bit(KEY_RIGHTCTRL, key))
+		return COUGAR_MOD_CTRL;
+	if (test_bit(KEY_LEFTALT, key))
+		return COUGAR_MOD_ALT;
+	if (test_bit(KEY_RIGHTALT, key))
+		return COUGAR_MOD_ALTGR;
+	if (test_bit(KEY_LEFTMETA, key) || test_bit(KEY_RIGHTMETA, key))
+		return COUGAR_MOD_META;
+	if (test_bit(KEY_LEFTSHIFT, key) || test_bit(KEY_RIGHTSHIFT, key))
+		return COUGAR_MOD_SHIFT;
+	return COUGAR_MOD_NONE;
+}
+
+/* Key for a vendor key event from the modifier table, 0 if not in it */
+unsigned int cougar_modmap_resolve(struct cougar_shared *shared,
+				   struct input_dev *input, unsigned char code,
+				   unsigned char action)
+{
+	struct cougar_modmap *modmap;
+	unsigned int keycode = 0;
+
+	rcu_read_lock();
+	modmap = rcu_dereference(shared->modmap);
+	if (modmap) {
+		if (action) {
+			keycode = modmap->map[cougar_mod_class(input)][code];
+			modmap->down[code] = keycode;
+		} else {
+			keycode = modmap->down[code];
+			modmap->down[code] = 0;
+		}
+	}
+	rcu_read_unlock();
+	return keycode;
+}
+
+/*
+ * Advertise the codes of the group's modifier table. Must be called with
+ * cougar_udev_list_lock held.
+ */
+void cougar_modmap_keybits(struct cougar_shared *shared)
+{
+	struct cougar_modmap *modmap;
+	unsigned int code, i;
+
+	modmap = rcu_dereference_protected(shared->modmap,
+					   lockdep_is_held(&cougar_udev_list_lock));
+	for (i = 0; modmap && i < COUGAR_MOD_CLASSES; i++)
+		for (code = 0; code < 256; code++)
+			if (modmap->map[i][code])
+				input_set_capability(shared->input, EV_KEY,
+						     modmap->map[i][code]);
+}
+
+/*
+ * Install a new modifier table (or none), releasing keys pressed through
+ * the old one
+ */
+static void cougar_modmap_update(struct cougar_shared *shared,
+				 struct cougar_modmap *modmap)
+{
+	struct cougar_modmap *old;
+	unsigned int code;
+
+	mutex_lock(&cougar_udev_list_lock);
+	old = rcu_dereference_protected(shared->modmap,
+					lockdep_is_held(&cougar_udev_list_lock));
+	rcu_assign_pointer(shared->modmap, modmap);
+	if (!old && modmap)
+		static_branch_inc(&cougar_modmap_key);
+	else if (old && !modmap)
+		static_branch_dec(&cougar_modmap_key);
+	cougar_update_keybits(shared);
+	mutex_unlock(&cougar_udev_list_lock);
+
+	if (!old)
+		return;
+
+	synchronize_rcu();
+	mutex_lock(&cougar_udev_list_lock);
+	for (code = 0; code < 256 && shared->input; code++)
+		if (old->down[code])
+			cougar_key(shared, shared->input, old->down[code], 0);
+	if (shared->input)
+		input_sync(shared->input);
+	mutex_unlock(&cougar_udev_list_lock);
+	kfree(old);
+}
+
+/* Free the modifier table of a group no interface uses any more */
+void cougar_modmap_exit(struct cougar_shared *shared)
+{
+	if (rcu_access_pointer(shared->modmap)) {
+		static_branch_dec(&cougar_modmap_key);
+		kfree(rcu_dereference_protected(shared->modmap, true));
+	}
+}
+
+/*
+ * sysfs "modmap": "<class>:<code>:<key>...", class one of none, shift,
+ * ctrl, alt, altgr and meta, vendor and key codes in any base, e.g.
+ * "shift:0x83:185 ctrl:0x83:186" sends F19 for Shift+G1 and F20 for
+ * Ctrl+G1. An empty string removes the table.
+ */
+static ssize_t modmap_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_modmap *modmap;
+	unsigned int i, code;
+	ssize_t len = 0;
+
+	rcu_read_lock();
+	modmap = rcu_dereference(cougar->shared->modmap);
+	for (i = 0; modmap && i < COUGAR_MOD_CLASSES; i++)
+		for (code = 0; code < 256; code++)
+			if (modmap->map[i][code])
+				len += scnprintf(buf + len, PAGE_SIZE - len,
+						 "%s%s:0x%02x:%u",
+						 len ? " " : "",
+						 cougar_mod_names[i], code,
+						 modmap->map[i][code]);
+	rcu_read_unlock();
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static ssize_t modmap_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_modmap *modmap = NULL;
+	char *args, *p, *tok, *name;
+	int class, code, key;
+	int error = -EINVAL;
+
+	args = kstrndup(buf, count, GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	p = strim(args);
+	if (*p) {
+		modmap = kzalloc(sizeof(*modmap), GFP_KERNEL);
+		if (!modmap) {
+			error = -ENOMEM;
+			goto out_free;
+		}
+
+		while ((tok = strsep(&p, " ")) != NULL) {
+			if (!*tok)
+				continue;
+			name = strsep(&tok, ":");
+			class = match_string(cougar_mod_names,
+					     COUGAR_MOD_CLASSES, name);
+			if (class < 0 || !tok ||
+			    sscanf(tok, "%i:%i", &code, &key) != 2 ||
+			    code <= 0 || code > 0xff ||
+			    key <= 0 || key >= KEY_CNT)
+				goto out_free;
+			modmap->map[class][code] = key;
+		}
+	}
+
+	cougar_modmap_update(cougar->shared, modmap);
+	kfree(args);
+	return count;
+
+out_free:
+	kfree(modmap);
+	kfree(args);
+	return error;
+}
+struct device_attribute cougar_attr_modmap = __ATTR_RW(modmap);
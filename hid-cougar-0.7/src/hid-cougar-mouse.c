@@ -0,0 +1,405 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: mouse keys
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static unsigned int cougar_mousekeys_hz = 1000;
+static unsigned int cougar_mousekeys_speed_min = 100;
+static unsigned int cougar_mousekeys_speed_max = 1200;
+static unsigned int cougar_mousekeys_accel_ms = 600;
+static unsigned int cougar_mousekeys_curve = 2;
+static unsigned int cougar_mousekeys_wheel = 15;
+module_param_named(mousekeys_hz, cougar_mousekeys_hz, uint, 0600);
+MODULE_PARM_DESC(mousekeys_hz,
+	"Mouse keys motion updates per second, 1 to 1000 (default=1000)");
+module_param_named(mousekeys_speed_min, cougar_mousekeys_speed_min, uint, 0600);
+MODULE_PARM_DESC(mousekeys_speed_min,
+	"Mouse keys pointer speed when a direction key is pressed, in px/s (default=100)");
+module_param_named(mousekeys_speed_max, cougar_mousekeys_speed_max, uint, 0600);
+MODULE_PARM_DESC(mousekeys_speed_max,
+	"Mouse keys pointer speed once fully accelerated, in px/s (default=1200)");
+module_param_named(mousekeys_accel_ms, cougar_mousekeys_accel_ms, uint, 0600);
+MODULE_PARM_DESC(mousekeys_accel_ms,
+	"Time for the mouse keys pointer to reach its full speed, in ms (default=600)");
+module_param_named(mousekeys_curve, cougar_mousekeys_curve, uint, 0600);
+MODULE_PARM_DESC(mousekeys_curve,
+	"Mouse keys acceleration curve (1=linear, 2=quadratic, 3=cubic) (default=2)");
+module_param_named(mousekeys_wheel, cougar_mousekeys_wheel, uint, 0600);
+MODULE_PARM_DESC(mousekeys_wheel,
+	"Mouse keys wheel speed, in detents/s (default=15)");
+
+DEFINE_STATIC_KEY_FALSE(cougar_mouse_key);
+
+/* Serializes mouse keys updates, see cougar_mouse_update() */
+static DEFINE_MUTEX(cougar_mouse_update_lock);
+
+/*
+ * Pointer speed in px/s after motion keys have been held for 'held':
+ * from speed_min to speed_max over accel_ms, along x^curve.
+ */
+static u64 cougar_mouse_speed(ktime_t held)
+{
+	unsigned int lo = cougar_mousekeys_speed_min;
+	unsigned int hi = max(cougar_mousekeys_speed_max, lo);
+	unsigned int accel = cougar_mousekeys_accel_ms;
+	unsigned int curve = clamp(cougar_mousekeys_curve, 1U, 3U);
+	u64 ms = ktime_to_ms(held), x = 1024, f;
+	unsigned int i;
+
+	if (accel && ms < accel)
+		x = div_u64(ms * 1024, accel);
+	for (f = x, i = 1; i < curve; i++)
+		f = f * x >> 10;
+	return lo + ((hi - lo) * f >> 10);
+}
+
+/* Emit the whole part of an accumulator, keeping the fraction */
+static void cougar_mouse_emit(struct input_dev *input, unsigned int axis,
+			      s64 *acc)
+{
+	s32 rem;
+	s64 rel = div_s64_rem(*acc, 1000, &rem);
+
+	if (rel) {
+		input_report_rel(input, axis, rel);
+		*acc = rem;
+	}
+}
+
+static enum hrtimer_restart cougar_mouse_tick(struct hrtimer *timer)
+{
+	struct cougar_mouse_state *ms = container_of(timer,
+						     struct cougar_mouse_state,
+						     timer);
+	unsigned long flags;
+	s64 step, wheel;
+	int dx, dy, dw;
+
+	spin_lock_irqsave(&ms->lock, flags);
+	if (!ms->held || !ms->input) {
+		spin_unlock_irqrestore(&ms->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	dx = !!(ms->held & BIT(COUGAR_MOUSE_RIGHT)) -
+	     !!(ms->held & BIT(COUGAR_MOUSE_LEFT));
+	dy = !!(ms->held & BIT(COUGAR_MOUSE_DOWN)) -
+	     !!(ms->held & BIT(COUGAR_MOUSE_UP));
+	dw = !!(ms->held & BIT(COUGAR_MOUSE_WHEEL_UP)) -
+	     !!(ms->held & BIT(COUGAR_MOUSE_WHEEL_DOWN));
+
+	/* Thousandths of a pixel (or detent) per period */
+	step = div_u64(cougar_mouse_speed(ktime_sub(ktime_get(), ms->since)) *
+		       ktime_to_ns(ms->period), NSEC_PER_MSEC);
+	wheel = div_u64((u64)cougar_mousekeys_wheel * ktime_to_ns(ms->period),
+			NSEC_PER_MSEC);
+	ms->acc_x += dx * step;
+	ms->acc_y += dy * step;
+	ms->acc_wheel += dw * wheel;
+
+	cougar_mouse_emit(ms->input, REL_X, &ms->acc_x);
+	cougar_mouse_emit(ms->input, REL_Y, &ms->acc_y);
+	cougar_mouse_emit(ms->input, REL_WHEEL, &ms->acc_wheel);
+	input_sync(ms->input);
+
+	hrtimer_forward_now(timer, ms->period);
+	spin_unlock_irqrestore(&ms->lock, flags);
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Mouse keys handling of a vendor key event, true if it was consumed.
+ * Buttons are reported right away, motion keys start the motion timer.
+ */
+bool cougar_mouse_event(struct cougar_shared *shared, unsigned char code,
+			unsigned char action)
+{
+	struct cougar_mouse_state *ms;
+	struct cougar_mousekeys *mk;
+	unsigned int button, act = COUGAR_MOUSE_NONE;
+	unsigned long flags;
+
+	rcu_read_lock();
+	mk = rcu_dereference(shared->mousekeys);
+	if (mk)
+		act = mk->action[code];
+	rcu_read_unlock();
+	if (act == COUGAR_MOUSE_NONE)
+		return false;
+
+	/* Published before the mouse keys */
+	ms = READ_ONCE(shared->mouse);
+
+	spin_lock_irqsave(&ms->lock, flags);
+	if (!ms->input) {
+		spin_unlock_irqrestore(&ms->lock, flags);
+		return true;
+	}
+
+	if (act > COUGAR_MOUSE_LAST_MOTION) {
+		button = act == COUGAR_MOUSE_BUTTON_LEFT ? BTN_LEFT :
+			 act == COUGAR_MOUSE_BUTTON_RIGHT ? BTN_RIGHT :
+			 BTN_MIDDLE;
+		input_report_key(ms->input, button, action);
+		input_sync(ms->input);
+	} else if (action) {
+		if (!ms->held) {
+			ms->since = ktime_get();
+			ms->period = ns_to_ktime(NSEC_PER_SEC /
+						 clamp(cougar_mousekeys_hz,
+						       1U, 1000U));
+			ms->acc_x = ms->acc_y = ms->acc_wheel = 0;
+			hrtimer_start(&ms->timer, 0, HRTIMER_MODE_REL);
+		}
+		ms->held |= BIT(act);
+	} else {
+		ms->held &= ~BIT(act);
+	}
+	spin_unlock_irqrestore(&ms->lock, flags);
+	return true;
+}
+
+/*
+ * Give the group its pointer state when mouse keys are first configured.
+ * Must be called with cougar_udev_list_lock and cougar_mouse_update_lock
+ * held.
+ */
+static int cougar_mouse_alloc(struct cougar_shared *shared)
+{
+	struct cougar_mouse_state *ms;
+
+	if (shared->mouse)
+		return 0;
+
+	ms = kzalloc(sizeof(*ms), GFP_KERNEL);
+	if (!ms)
+		return -ENOMEM;
+	spin_lock_init(&ms->lock);
+	hrtimer_setup(&ms->timer, cougar_mouse_tick, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL);
+	smp_store_release(&shared->mouse, ms);
+	return 0;
+}
+
+/*
+ * Stop the motion and release the buttons, and the pointer device itself
+ * if 'destroy' is set. Must be called once no vendor event can reach the
+ * old configuration.
+ */
+static void cougar_mouse_reset(struct cougar_mouse_state *ms, bool destroy)
+{
+	struct input_dev *input;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ms->lock, flags);
+	ms->held = 0;
+	input = ms->input;
+	if (destroy)
+		ms->input = NULL;
+	spin_unlock_irqrestore(&ms->lock, flags);
+	hrtimer_cancel(&ms->timer);
+
+	if (!input)
+		return;
+	input_report_key(input, BTN_LEFT, 0);
+	input_report_key(input, BTN_RIGHT, 0);
+	input_report_key(input, BTN_MIDDLE, 0);
+	input_sync(input);
+	if (destroy)
+		input_unregister_device(input);
+}
+
+/* Free the mouse keys and pointer of a group no interface uses any more */
+void cougar_mouse_exit(struct cougar_shared *shared)
+{
+	if (rcu_access_pointer(shared->mousekeys)) {
+		static_branch_dec(&cougar_mouse_key);
+		kfree(rcu_dereference_protected(shared->mousekeys, true));
+	}
+	if (shared->mouse) {
+		cougar_mouse_reset(shared->mouse, true);
+		kfree(shared->mouse);
+	}
+}
+
+static const char * const cougar_mouse_names[COUGAR_MOUSE_ACTIONS] = {
+	[COUGAR_MOUSE_NONE]		= "none",
+	[COUGAR_MOUSE_UP]		= "up",
+	[COUGAR_MOUSE_DOWN]		= "down",
+	[COUGAR_MOUSE_LEFT]		= "left",
+	[COUGAR_MOUSE_RIGHT]		= "right",
+	[COUGAR_MOUSE_WHEEL_UP]		= "wheel_up",
+	[COUGAR_MOUSE_WHEEL_DOWN]	= "wheel_down",
+	[COUGAR_MOUSE_BUTTON_LEFT]	= "button_left",
+	[COUGAR_MOUSE_BUTTON_RIGHT]	= "button_right",
+	[COUGAR_MOUSE_BUTTON_MIDDLE]	= "button_middle",
+};
+
+/* Pointer device of the group, owned by the driver */
+static struct input_dev *cougar_mouse_create(struct hid_device *hdev,
+					     struct cougar_mouse_state *ms)
+{
+	struct input_dev *input;
+
+	input = input_allocate_device();
+	if (!input)
+		return NULL;
+
+	snprintf(ms->phys, sizeof(ms->phys), "%s/mousekeys", hdev->phys);
+	input->name = "Cougar Mouse Keys";
+	input->phys = ms->phys;
+	input->id.bustype = hdev->bus;
+	input->id.vendor = hdev->vendor;
+	input->id.product = hdev->product;
+	input->id.version = hdev->version;
+	input_set_capability(input, EV_REL, REL_X);
+	input_set_capability(input, EV_REL, REL_Y);
+	input_set_capability(input, EV_REL, REL_WHEEL);
+	input_set_capability(input, EV_KEY, BTN_LEFT);
+	input_set_capability(input, EV_KEY, BTN_RIGHT);
+	input_set_capability(input, EV_KEY, BTN_MIDDLE);
+
+	if (input_register_device(input)) {
+		input_free_device(input);
+		return NULL;
+	}
+	return input;
+}
+
+/*
+ * Install new mouse keys (or none). The pointer device exists while mouse
+ * keys are configured. Only publishing the mouse keys is done under
+ * cougar_udev_list_lock: creating the pointer, waiting for readers of the
+ * old mouse keys and unregistering it are serialized by
+ * cougar_mouse_update_lock instead.
+ */
+static int cougar_mouse_update(struct hid_device *hdev,
+			       struct cougar_shared *shared,
+			       struct cougar_mousekeys *mk)
+{
+	struct cougar_mouse_state *ms;
+	struct cougar_mousekeys *old;
+	struct input_dev *input;
+	unsigned long flags;
+	int error = 0;
+
+	mutex_lock(&cougar_mouse_update_lock);
+	if (mk) {
+		mutex_lock(&cougar_udev_list_lock);
+		error = cougar_mouse_alloc(shared);
+		mutex_unlock(&cougar_udev_list_lock);
+		if (error)
+			goto out_unlock;
+	}
+	ms = shared->mouse;
+	if (mk && !ms->input) {
+		input = cougar_mouse_create(hdev, ms);
+		if (!input) {
+			error = -ENOMEM;
+			goto out_unlock;
+		}
+		spin_lock_irqsave(&ms->lock, flags);
+		ms->input = input;
+		spin_unlock_irqrestore(&ms->lock, flags);
+	}
+
+	mutex_lock(&cougar_udev_list_lock);
+	old = rcu_dereference_protected(shared->mousekeys,
+					lockdep_is_held(&cougar_udev_list_lock));
+	rcu_assign_pointer(shared->mousekeys, mk);
+	if (!old && mk)
+		static_branch_inc(&cougar_mouse_key);
+	else if (old && !mk)
+		static_branch_dec(&cougar_mouse_key);
+	mutex_unlock(&cougar_udev_list_lock);
+
+	if (old) {
+		synchronize_rcu();
+		cougar_mouse_reset(ms, !mk);
+		kfree(old);
+	}
+
+out_unlock:
+	mutex_unlock(&cougar_mouse_update_lock);
+	return error;
+}
+
+/*
+ * sysfs "mousekeys": "<code>:<action>...", vendor codes in any base and
+ * actions from cougar_mouse_names, e.g. "0x83:left 0x84:down 0x85:right
+ * 0x86:up 0x87:button_left" moves the pointer with G1-G4 and clicks with
+ * G5. An empty string removes the mouse keys and their pointer.
+ */
+static ssize_t mousekeys_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_mousekeys *mk;
+	unsigned int code;
+	ssize_t len = 0;
+
+	rcu_read_lock();
+	mk = rcu_dereference(cougar->shared->mousekeys);
+	for (code = 0; mk && code < 256; code++)
+		if (mk->action[code])
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					 "%s0x%02x:%s", len ? " " : "", code,
+					 cougar_mouse_names[mk->action[code]]);
+	rcu_read_unlock();
+	len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	return len;
+}
+
+static ssize_t mousekeys_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct cougar *cougar = hid_get_drvdata(to_hid_device(dev));
+	struct cougar_mousekeys *mk = NULL;
+	char *args, *p, *tok, *name;
+	int code, action;
+	int error = -EINVAL;
+
+	args = kstrndup(buf, count, GFP_KERNEL);
+	if (!args)
+		return -ENOMEM;
+
+	p = strim(args);
+	if (*p) {
+		mk = kzalloc(sizeof(*mk), GFP_KERNEL);
+		if (!mk) {
+			error = -ENOMEM;
+			goto out_free;
+		}
+		while ((tok = strsep(&p, " ")) != NULL) {
+			if (!*tok)
+				continue;
+			name = strchr(tok, ':');
+			if (!name)
+				goto out_free;
+			*name++ = '\0';
+			action = match_string(cougar_mouse_names,
+					      COUGAR_MOUSE_ACTIONS, name);
+			if (kstrtoint(tok, 0, &code) ||
+			    code <= 0 || code > 0xff || action < 0)
+				goto out_free;
+			mk->action[code] = action;
+		}
+	}
+
+	error = cougar_mouse_update(to_hid_device(dev), cougar->shared, mk);
+	if (error)
+		goto out_free;
+	kfree(args);
+	return count;
+
+out_free:
+	kfree(mk);
+	kfree(args);
+	return error;
+}
+struct device_attribute cougar_attr_mousekeys = __ATTR_RW(mousekeys);
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: NKRO report decoder
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static bool cougar_nkro_fastpath = true;
+module_param_named(nkro_fastpath, cougar_nkro_fastpath, bool, 0600);
+MODULE_PARM_DESC(nkro_fastpath,
+	"Decode NKRO key bitmap reports in the driver, checked on probe (0=off, 1=on) (default=1)");
+
+DEFINE_STATIC_KEY_FALSE(cougar_nkro_key);
+
+/*
+ * Look for an input report that is a plain key bitmap (NKRO mode) and
+ * prepare its decoder. Must be called once hid-input has mapped usages.
+ */
+void cougar_nkro_setup(struct hid_device *hdev, struct cougar *cougar)
+{
+	struct hid_report_enum *report_enum = &hdev->report_enum[HID_INPUT_REPORT];
+	struct cougar_nkro *nkro;
+	struct hid_report *report;
+	struct hid_field *field;
+	unsigned int i, n, keys, bytes, words;
+
+	/* Payload bytes are copied as is into the bitmaps */
+	if (!cougar_nkro_fastpath || IS_ENABLED(CONFIG_CPU_BIG_ENDIAN))
+		return;
+
+	list_for_each_entry(report, &report_enum->report_list, list) {
+		keys = 0;
+		for (i = 0; i < report->maxfield; i++) {
+			field = report->field[i];
+			if (!(field->flags & HID_MAIN_ITEM_VARIABLE) ||
+			    field->report_size != 1 || !field->hidinput)
+				break;
+			keys += field->report_count;
+		}
+		if (i == report->maxfield && keys >= COUGAR_NKRO_MIN_KEYS)
+			break;
+	}
+	if (&report->list == &report_enum->report_list)
+		return;
+
+	bytes = DIV_ROUND_UP(report->size, 8);
+	words = BITS_TO_LONGS(bytes * 8);
+	nkro = devm_kzalloc(&hdev->dev, sizeof(*nkro) +
+			    bytes * 8 * sizeof(*nkro->usage) +
+			    3 * words * sizeof(unsigned long), GFP_KERNEL);
+	if (!nkro)
+		return;
+
+	nkro->state = (unsigned long *)(nkro + 1);
+	nkro->next = nkro->state + words;
+	nkro->changed = nkro->next + words;
+	nkro->usage = (struct hid_usage **)(nkro->changed + words);
+	nkro->report_id = report->id;
+	nkro->numbered = report_enum->numbered ? 1 : 0;
+	nkro->bytes = bytes;
+
+	for (i = 0; i < report->maxfield; i++) {
+		field = report->field[i];
+		nkro->input = field->hidinput->input;
+		for (n = 0; n < min(field->report_count, field->maxusage); n++)
+			nkro->usage[field->report_offset + n] =
+				&field->usage[n];
+	}
+
+	cougar->nkro = nkro;
+	static_branch_inc(&cougar_nkro_key);
+	hid_dbg(hdev, "NKRO report %u: %u keys decoded by the driver\n",
+		report->id, keys);
+}
+
+/* Stop decoding, the decoder itself is device-managed */
+void cougar_nkro_exit(struct cougar *cougar)
+{
+	if (!cougar->nkro)
+		return;
+	static_branch_dec(&cougar_nkro_key);
+	cougar->nkro = NULL;
+}
+
+/*
+ * Emit only the keys whose bit changed since the previous NKRO report,
+ * comparing whole words, instead of letting hid-core walk every field.
+ */
+int cougar_nkro_decode(struct hid_device *hdev, struct cougar *cougar,
+		       u8 *data, int size)
+{
+	struct cougar_nkro *nkro = cougar->nkro;
+	unsigned int nbits = nkro->bytes * 8;
+	struct hid_usage *usage;
+	unsigned long *prev;
+	unsigned int bit;
+	bool hooks;
+	s32 value;
+
+	if (size < nkro->numbered + nkro->bytes)
+		return 0;
+
+	memcpy(nkro->next, data + nkro->numbered, nkro->bytes);
+	bitmap_xor(nkro->changed, nkro->next, nkro->state, nbits);
+
+	/* See cougar_remove() */
+	rcu_read_lock();
+	hooks = cougar_keyboard_hooks() && cougar->shared &&
+		READ_ONCE(cougar->shared->enabled);
+	for_each_set_bit(bit, nkro->changed, nbits) {
+		usage = nkro->usage[bit];
+		if (!usage || usage->type != EV_KEY || !usage->code)
+			continue;
+		value = test_bit(bit, nkro->next);
+		if (hooks && cougar_keyboard_key(cougar->shared, nkro->input,
+						 usage->code, value))
+			continue;
+		/* As hidinput_hid_event(), scancode first */
+		if (!!test_bit(usage->code, nkro->input->key) != value)
+			input_event(nkro->input, EV_MSC, MSC_SCAN, usage->hid);
+		input_event(nkro->input, EV_KEY, usage->code, value);
+	}
+	rcu_read_unlock();
+	input_sync(nkro->input);
+
+	prev = nkro->state;
+	nkro->state = nkro->next;
+	nkro->next = prev;
+
+	if (hdev->claimed & HID_CLAIMED_HIDRAW)
+		hidraw_report_event(hdev, data, size);
+	return COUGAR_REPORT_CONSUMED;
+}
@@ -0,0 +1,180 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: per-key autorepeat
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static bool cougar_key_repeat;
+module_param_named(repeat, cougar_key_repeat, bool, 0600);
+MODULE_PARM_DESC(repeat,
+	"Repeat every held key of keyboards probed afterwards, G-keys included, from the driver instead of the input core (0=off, 1=on) (default=0)");
+
+DEFINE_STATIC_KEY_FALSE(cougar_repeat_key);
+
+static enum hrtimer_restart cougar_repeat_tick(struct hrtimer *timer)
+{
+	struct cougar_repeat_state *rs = container_of(timer,
+						      struct cougar_repeat_state,
+						      timer);
+	ktime_t now = ktime_get(), next = KTIME_MAX, period;
+	struct cougar_held_key *key;
+	unsigned long flags;
+	bool repeated = false;
+	unsigned int i;
+
+	spin_lock_irqsave(&rs->lock, flags);
+	if (!rs->input || !rs->input->rep[REP_PERIOD])
+		rs->held = 0;
+	if (!rs->held) {
+		spin_unlock_irqrestore(&rs->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	period = ms_to_ktime(rs->input->rep[REP_PERIOD]);
+	for (i = 0; i < rs->held; i++) {
+		key = &rs->keys[i];
+		if (!ktime_after(key->next, now)) {
+			input_event(rs->input, EV_KEY, key->code, 2);
+			key->next = ktime_add(now, period);
+			repeated = true;
+		}
+		if (ktime_before(key->next, next))
+			next = key->next;
+	}
+	if (repeated)
+		input_sync(rs->input);
+
+	hrtimer_set_expires(timer, next);
+	spin_unlock_irqrestore(&rs->lock, flags);
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Track the keys held on the repeat input device. A press of a key that
+ * is already held (hid-core reports held modifiers with every report)
+ * does not restart its delay.
+ */
+void cougar_repeat_event(struct cougar_shared *shared, struct input_dev *input,
+			 unsigned int code, s32 value)
+{
+	struct cougar_repeat_state *rs = READ_ONCE(shared->repeat);
+	unsigned long flags;
+	unsigned int i;
+	ktime_t next;
+
+	if (!rs)
+		return;
+
+	spin_lock_irqsave(&rs->lock, flags);
+	if (input != rs->input || value > 1)
+		goto out;
+
+	for (i = 0; i < rs->held && rs->keys[i].code != code; i++)
+		;
+	if (!value) {
+		if (i == rs->held)
+			goto out;
+		rs->keys[i] = rs->keys[--rs->held];
+		if (!rs->held)
+			hrtimer_try_to_cancel(&rs->timer);
+	} else if (i == rs->held && i < COUGAR_REPEAT_MAX &&
+		   input->rep[REP_DELAY] && input->rep[REP_PERIOD]) {
+		next = ktime_add_ms(ktime_get(), input->rep[REP_DELAY]);
+		rs->keys[i].code = code;
+		rs->keys[i].next = next;
+		rs->held++;
+		if (rs->held == 1 || !hrtimer_active(&rs->timer) ||
+		    ktime_before(next, hrtimer_get_expires(&rs->timer)))
+			hrtimer_start(&rs->timer, next, HRTIMER_MODE_ABS);
+	}
+out:
+	spin_unlock_irqrestore(&rs->lock, flags);
+}
+
+/*
+ * Give the group its repeat state when first started. Must be called with
+ * cougar_udev_list_lock held.
+ */
+static struct cougar_repeat_state *
+cougar_repeat_alloc(struct cougar_shared *shared)
+{
+	struct cougar_repeat_state *rs = shared->repeat;
+
+	if (rs)
+		return rs;
+
+	rs = kzalloc(sizeof(*rs), GFP_KERNEL);
+	if (!rs)
+		return NULL;
+	spin_lock_init(&rs->lock);
+	hrtimer_setup(&rs->timer, cougar_repeat_tick, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+	smp_store_release(&shared->repeat, rs);
+	return rs;
+}
+
+/* Free the repeat state of a group no interface uses any more */
+void cougar_repeat_exit(struct cougar_shared *shared)
+{
+	if (shared->repeat) {
+		hrtimer_cancel(&shared->repeat->timer);
+		kfree(shared->repeat);
+	}
+}
+
+/*
+ * Take over the autorepeat of the keyboard intf's input device, if the
+ * repeat parameter asks for it. Must be called before it is registered:
+ * with REP_DELAY and REP_PERIOD already set (to the input core's
+ * defaults), the input core leaves repeat to the driver, and EVIOCSREP
+ * only updates them.
+ */
+void cougar_repeat_start(struct cougar *cougar, struct input_dev *input)
+{
+	struct cougar_repeat_state *rs;
+	unsigned long flags;
+
+	if (!cougar_key_repeat || !cougar->shared || cougar->repeat ||
+	    !test_bit(EV_REP, input->evbit))
+		return;
+
+	mutex_lock(&cougar_udev_list_lock);
+	rs = cougar_repeat_alloc(cougar->shared);
+	mutex_unlock(&cougar_udev_list_lock);
+	/* Left to the input core then */
+	if (!rs)
+		return;
+
+	input->rep[REP_DELAY] = 250;
+	input->rep[REP_PERIOD] = 33;
+
+	spin_lock_irqsave(&rs->lock, flags);
+	rs->input = input;
+	rs->held = 0;
+	spin_unlock_irqrestore(&rs->lock, flags);
+
+	cougar->repeat = true;
+	static_branch_inc(&cougar_repeat_key);
+}
+
+void cougar_repeat_stop(struct cougar *cougar)
+{
+	struct cougar_repeat_state *rs;
+	unsigned long flags;
+
+	if (!cougar->repeat)
+		return;
+	rs = cougar->shared->repeat;
+
+	spin_lock_irqsave(&rs->lock, flags);
+	rs->input = NULL;
+	rs->held = 0;
+	spin_unlock_irqrestore(&rs->lock, flags);
+	hrtimer_cancel(&rs->timer);
+
+	cougar->repeat = false;
+	static_branch_dec(&cougar_repeat_key);
+}
@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: mmap event ring
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static unsigned int cougar_event_ring;
+module_param_named(event_ring, cougar_event_ring, uint, 0400);
+MODULE_PARM_DESC(event_ring,
+	"Records in the per-device mmap event ring, rounded up to a power of two (0=disabled) (default=0)");
+
+DEFINE_STATIC_KEY_FALSE(cougar_ring_key);
+
+static struct cougar_ring *cougar_ring_create(unsigned int size)
+{
+	struct cougar_ring *ring;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+
+	size = roundup_pow_of_two(size);
+	ring->hdr = vmalloc_user(PAGE_SIZE + size * sizeof(*ring->rec));
+	if (!ring->hdr) {
+		kfree(ring);
+		return NULL;
+	}
+	ring->hdr->version = COUGAR_RING_VERSION;
+	ring->hdr->size = size;
+	ring->rec = (void *)ring->hdr + PAGE_SIZE;
+	ring->mask = size - 1;
+	ring->wake = U64_MAX;
+
+	kref_init(&ring->kref);
+	spin_lock_init(&ring->lock);
+	init_waitqueue_head(&ring->wait);
+	INIT_LIST_HEAD(&ring->readers);
+	static_branch_inc(&cougar_ring_key);
+	return ring;
+}
+
+static void cougar_ring_release(struct kref *kref)
+{
+	struct cougar_ring *ring = container_of(kref, struct cougar_ring, kref);
+
+	static_branch_dec(&cougar_ring_key);
+	vfree(ring->hdr);
+	kfree(ring);
+}
+
+/* Give a new group its ring, if the event_ring parameter asks for one */
+int cougar_ring_init(struct cougar_shared *shared)
+{
+	if (!cougar_event_ring)
+		return 0;
+
+	shared->ring = cougar_ring_create(cougar_event_ring);
+	return shared->ring ? 0 : -ENOMEM;
+}
+
+void cougar_ring_exit(struct cougar_shared *shared)
+{
+	if (shared->ring)
+		kref_put(&shared->ring->kref, cougar_ring_release);
+}
+
+/* Must be called with ring->lock held */
+static void cougar_ring_update_wake(struct cougar_ring *ring)
+{
+	struct cougar_ring_reader *reader;
+
+	ring->wake = U64_MAX;
+	list_for_each_entry(reader, &ring->readers, list)
+		ring->wake = min(ring->wake, reader->wake);
+}
+
+/*
+ * Single-producer append: the vendor and keyboard interfaces may complete
+ * reports on different CPUs, so the lock only keeps them from interleaving.
+ * Waiters are woken once a reader's threshold is reached, never per
+ * record: a reader that doesn't read is woken again 'threshold' records
+ * later.
+ */
+void cougar_ring_push(struct cougar_shared *shared, u8 source, u16 code,
+		      s32 action)
+{
+	struct cougar_ring *ring = shared->ring;
+	struct cougar_ring_reader *reader;
+	struct cougar_ring_record *rec;
+	unsigned long flags;
+	bool wake = false;
+	u64 head;
+
+	if (!ring)
+		return;
+
+	spin_lock_irqsave(&ring->lock, flags);
+	head = ring->hdr->head;
+	/* Publish of the previous head must be visible before overwriting */
+	smp_wmb();
+	rec = &ring->rec[head & ring->mask];
+	rec->timestamp = ktime_get_ns();
+	rec->code = code;
+	rec->action = action;
+	rec->source = source;
+	smp_store_release(&ring->hdr->head, head + 1);
+
+	if (head + 1 >= ring->wake) {
+		list_for_each_entry(reader, &ring->readers, list)
+			if (reader->wake <= head + 1)
+				reader->wake = head + 1 + reader->threshold;
+		cougar_ring_update_wake(ring);
+		wake = true;
+	}
+	spin_unlock_irqrestore(&ring->lock, flags);
+
+	if (wake)
+		wake_up_interruptible(&ring->wait);
+}
+
+static int cougar_ring_open(struct inode *inode, struct file *file)
+{
+	struct hid_device *hdev = inode->i_private;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_ring_reader *reader;
+	struct cougar_ring *ring = NULL;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	mutex_lock(&cougar_udev_list_lock);
+	if (cougar && cougar->shared && cougar->shared->ring) {
+		ring = cougar->shared->ring;
+		kref_get(&ring->kref);
+	}
+	mutex_unlock(&cougar_udev_list_lock);
+	if (!ring) {
+		kfree(reader);
+		return -ENODEV;
+	}
+
+	reader->ring = ring;
+	reader->threshold = 1;
+	spin_lock_irq(&ring->lock);
+	reader->mark = ring->hdr->head;
+	reader->wake = reader->mark + reader->threshold;
+	list_add_tail(&reader->list, &ring->readers);
+	cougar_ring_update_wake(ring);
+	spin_unlock_irq(&ring->lock);
+
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int cougar_ring_release_file(struct inode *inode, struct file *file)
+{
+	struct cougar_ring_reader *reader = file->private_data;
+	struct cougar_ring *ring = reader->ring;
+
+	spin_lock_irq(&ring->lock);
+	list_del(&reader->list);
+	cougar_ring_update_wake(ring);
+	spin_unlock_irq(&ring->lock);
+
+	kfree(reader);
+	kref_put(&ring->kref, cougar_ring_release);
+	return 0;
+}
+
+static ssize_t cougar_ring_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct cougar_ring_reader *reader = file->private_data;
+	struct cougar_ring *ring = reader->ring;
+	u64 head;
+
+	if (count < sizeof(head))
+		return -EINVAL;
+
+	head = smp_load_acquire(&ring->hdr->head);
+	if (copy_to_user(buf, &head, sizeof(head)))
+		return -EFAULT;
+
+	spin_lock_irq(&ring->lock);
+	reader->mark = head;
+	reader->wake = head + reader->threshold;
+	cougar_ring_update_wake(ring);
+	spin_unlock_irq(&ring->lock);
+	return sizeof(head);
+}
+
+static ssize_t cougar_ring_write(struct file *file, const char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct cougar_ring_reader *reader = file->private_data;
+	struct cougar_ring *ring = reader->ring;
+	unsigned int threshold;
+	int error;
+
+	error = kstrtouint_from_user(buf, count, 0, &threshold);
+	if (error)
+		return error;
+	if (!threshold || threshold > ring->hdr->size / 2)
+		return -EINVAL;
+
+	spin_lock_irq(&ring->lock);
+	reader->threshold = threshold;
+	reader->wake = reader->mark + threshold;
+	cougar_ring_update_wake(ring);
+	spin_unlock_irq(&ring->lock);
+	return count;
+}
+
+static __poll_t cougar_ring_poll(struct file *file, poll_table *wait)
+{
+	struct cougar_ring_reader *reader = file->private_data;
+	struct cougar_ring *ring = reader->ring;
+
+	poll_wait(file, &ring->wait, wait);
+	if (smp_load_acquire(&ring->hdr->head) - reader->mark >=
+	    reader->threshold)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+static int cougar_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct cougar_ring_reader *reader = file->private_data;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vm_flags_clear(vma, VM_MAYWRITE);
+
+	return remap_vmalloc_range(vma, reader->ring->hdr, vma->vm_pgoff);
+}
+
+static const struct file_operations cougar_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= cougar_ring_open,
+	.release	= cougar_ring_release_file,
+	.read		= cougar_ring_read,
+	.write		= cougar_ring_write,
+	.poll		= cougar_ring_poll,
+	.mmap		= cougar_ring_mmap,
+};
+
+void cougar_ring_debugfs_init(struct hid_device *hdev, struct cougar *cougar)
+{
+	if (cougar->shared->ring)
+		cougar->debug_events = debugfs_create_file("cougar_events", 0400,
+							   hdev->debug_dir, hdev,
+							   &cougar_ring_fops);
+}
+
+void cougar_ring_debugfs_exit(struct cougar *cougar)
+{
+	debugfs_remove(cougar->debug_events);
+}
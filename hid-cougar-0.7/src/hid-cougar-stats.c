@@ -0,0 +1,243 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: report, probe and memory
+ *  statistics
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+static bool cougar_stats;
+
+DEFINE_STATIC_KEY_FALSE(cougar_stats_key);
+
+/* Give the interface its statistics, if it has none yet */
+static void cougar_stats_alloc(struct cougar *cougar)
+{
+	struct cougar_stats *stats;
+
+	if (cougar->stats)
+		return;
+	stats = kzalloc(sizeof(*stats), GFP_KERNEL);
+	/* Its reports are only counted once it is all set */
+	if (stats)
+		smp_store_release(&cougar->stats, stats);
+}
+
+static int cougar_stats_set(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error)
+		return error;
+
+	if (cougar_stats) {
+		cougar_for_each_intf(cougar_stats_alloc);
+		static_branch_enable(&cougar_stats_key);
+	} else {
+		static_branch_disable(&cougar_stats_key);
+	}
+	return 0;
+}
+
+static const struct kernel_param_ops cougar_stats_ops = {
+	.set	= cougar_stats_set,
+	.get	= param_get_bool,
+};
+module_param_cb(stats, &cougar_stats_ops, &cougar_stats, 0600);
+MODULE_PARM_DESC(stats,
+	"Count received and repeated reports and time the first accepted one per interface in debugfs (0=off, 1=on) (default=0)");
+
+void cougar_stats_accepted(struct cougar *cougar)
+{
+	struct cougar_stats *stats = READ_ONCE(cougar->stats);
+
+	if (stats && !stats->probe.first_event && stats->probe.start)
+		stats->probe.first_event =
+			ktime_to_ns(ktime_sub(ktime_get(), stats->probe.start));
+}
+
+/*
+ * Count a report received by the interface. Those of the keyboard intf
+ * are all accepted, the vendor intf's only once past its own checks.
+ */
+void cougar_stats_account(struct cougar *cougar, u8 *data, int size)
+{
+	struct cougar_stats *stats = READ_ONCE(cougar->stats);
+
+	if (!stats)
+		return;
+
+	stats->reports++;
+	if (size == stats->last_size && !memcmp(data, stats->last, size))
+		stats->repeated++;
+
+	if (size <= COUGAR_STATS_REPORT_MAX) {
+		memcpy(stats->last, data, size);
+		stats->last_size = size;
+	} else {
+		stats->last_size = -1;
+	}
+
+	if (!cougar->special_intf)
+		cougar_stats_accepted(cougar);
+}
+
+/*
+ * Record the probe phases timed so far, first_event excepted, if stats
+ * are enabled. Must be called with the interface bound.
+ */
+void cougar_stats_probe(struct cougar *cougar,
+			const struct cougar_probe_times *t)
+{
+	struct cougar_stats *stats;
+	u64 first_event;
+
+	if (READ_ONCE(cougar_stats)) {
+		mutex_lock(&cougar_udev_list_lock);
+		cougar_stats_alloc(cougar);
+		mutex_unlock(&cougar_udev_list_lock);
+	}
+	stats = cougar->stats;
+	if (!stats)
+		return;
+
+	first_event = stats->probe.first_event;
+	stats->probe = *t;
+	stats->probe.first_event = first_event;
+}
+
+/* Free the statistics of an interface whose slot is being released */
+void cougar_stats_unbind(struct cougar *cougar)
+{
+	kfree(cougar->stats);
+	cougar->stats = NULL;
+}
+
+static int cougar_stats_show(struct seq_file *m, void *unused)
+{
+	struct hid_device *hdev = m->private;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_stats *stats;
+
+	if (!cougar)
+		return -ENODEV;
+
+	stats = READ_ONCE(cougar->stats);
+	seq_printf(m, "reports %llu\nrepeated %llu\n",
+		   stats ? stats->reports : 0, stats ? stats->repeated : 0);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cougar_stats);
+
+static int cougar_probe_show(struct seq_file *m, void *unused)
+{
+	struct hid_device *hdev = m->private;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	static const struct cougar_probe_times none;
+	const struct cougar_probe_times *t = &none;
+	struct cougar_shared *shared;
+	struct cougar_stats *stats;
+	unsigned int groups = 0;
+
+	if (!cougar)
+		return -ENODEV;
+
+	/* Only interfaces probed while stats were enabled were timed */
+	stats = READ_ONCE(cougar->stats);
+	if (stats)
+		t = &stats->probe;
+	seq_printf(m, "parse %llu\nhw_start %llu\nlock_wait %llu\nbind %llu\n",
+		   t->parse, t->hw_start, t->lock_wait, t->bind);
+	seq_printf(m, "open %llu\ntotal %llu\nfirst_event %llu\n",
+		   t->open, t->total, t->first_event);
+
+	mutex_lock(&cougar_udev_list_lock);
+	list_for_each_entry(shared, &cougar_udev_list, list)
+		groups++;
+	seq_printf(m, "groups %u\ngroup_refs %u\n", groups,
+		   kref_read(&cougar->shared->kref));
+	mutex_unlock(&cougar_udev_list_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cougar_probe);
+
+/*
+ * Estimate of what hid-core allocated for the interface's reports: every
+ * field holds a usage and a value per declared usage, so a wide Usage
+ * Minimum/Maximum range dominates the footprint.
+ */
+static size_t cougar_hid_reports_size(struct hid_device *hdev)
+{
+	struct hid_report_enum *report_enum;
+	struct hid_report *report;
+	struct hid_field *field;
+	size_t size = 0;
+	int type, i;
+
+	for (type = HID_INPUT_REPORT; type <= HID_FEATURE_REPORT; type++) {
+		report_enum = &hdev->report_enum[type];
+		list_for_each_entry(report, &report_enum->report_list, list) {
+			size += sizeof(*report);
+			for (i = 0; i < report->maxfield; i++) {
+				field = report->field[i];
+				size += sizeof(*field) +
+					field->maxusage * sizeof(*field->usage) +
+					field->report_count * sizeof(*field->value);
+			}
+		}
+	}
+	return size;
+}
+
+static int cougar_memory_show(struct seq_file *m, void *unused)
+{
+	struct hid_device *hdev = m->private;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_shared *shared;
+
+	if (!cougar)
+		return -ENODEV;
+
+	/* Group allocations are shared by all interfaces of the keyboard */
+	shared = cougar->shared;
+	seq_printf(m, "group %zu\nring %zu\n", sizeof(*shared),
+		   cougar_ring_memory(shared));
+	seq_printf(m, "layer %zu\ndual_role %zu\n", cougar_layer_memory(shared),
+		   cougar_dual_memory(shared));
+	seq_printf(m, "modmap %zu\n", cougar_modmap_memory(shared));
+	seq_printf(m, "mousekeys %zu\n", cougar_mouse_memory(shared));
+	seq_printf(m, "repeat %zu\naggregate %zu\n",
+		   cougar_repeat_memory(shared), cougar_aggregate_memory(shared));
+	/* Then those of this interface */
+	seq_printf(m, "nkro %zu\n", cougar_nkro_memory(cougar));
+	seq_printf(m, "stats %zu\nstorm %zu\ninject %zu\n",
+		   READ_ONCE(cougar->stats) ? sizeof(*cougar->stats) : 0,
+		   cougar_storm_memory(cougar), cougar_inject_memory(cougar));
+	seq_printf(m, "rdesc %u\nhid_reports %zu\n", hdev->rsize,
+		   cougar_hid_reports_size(hdev));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cougar_memory);
+
+void cougar_stats_debugfs_init(struct hid_device *hdev, struct cougar *cougar)
+{
+	cougar->debug_stats = debugfs_create_file("cougar_stats", 0400,
+						  hdev->debug_dir, hdev,
+						  &cougar_stats_fops);
+	cougar->debug_probe = debugfs_create_file("cougar_probe", 0400,
+						  hdev->debug_dir, hdev,
+						  &cougar_probe_fops);
+	cougar->debug_memory = debugfs_create_file("cougar_memory", 0400,
+						   hdev->debug_dir, hdev,
+						   &cougar_memory_fops);
+}
+
+void cougar_stats_debugfs_exit(struct cougar *cougar)
+{
+	debugfs_remove(cougar->debug_memory);
+	debugfs_remove(cougar->debug_probe);
+	debugfs_remove(cougar->debug_stats);
+}
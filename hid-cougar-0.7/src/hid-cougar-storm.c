@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: vendor report storm throttle
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#include "hid-cougar.h"
+
+#define COUGAR_STORM_BURST	32
+
+static unsigned int cougar_storm_rate;
+static u64 cougar_storm_cost_ns;
+
+DEFINE_STATIC_KEY_FALSE(cougar_storm_key);
+
+/* Give a vendor intf its throttle state, if it has none yet */
+static void cougar_storm_alloc(struct cougar *cougar)
+{
+	struct cougar_storm *storm;
+
+	if (!cougar->special_intf || cougar->storm)
+		return;
+	storm = kzalloc(sizeof(*storm), GFP_KERNEL);
+	/* Its reports are only throttled once it is all set */
+	if (storm)
+		smp_store_release(&cougar->storm, storm);
+}
+
+static int cougar_storm_rate_set(const char *val, const struct kernel_param *kp)
+{
+	unsigned int rate;
+	int error;
+
+	error = kstrtouint(val, 0, &rate);
+	if (error)
+		return error;
+
+	WRITE_ONCE(cougar_storm_cost_ns, rate ? div_u64(NSEC_PER_SEC, rate) : 0);
+	cougar_storm_rate = rate;
+	if (rate) {
+		cougar_for_each_intf(cougar_storm_alloc);
+		static_branch_enable(&cougar_storm_key);
+	} else {
+		static_branch_disable(&cougar_storm_key);
+	}
+	return 0;
+}
+
+static const struct kernel_param_ops cougar_storm_rate_ops = {
+	.set	= cougar_storm_rate_set,
+	.get	= param_get_uint,
+};
+module_param_cb(storm_rate, &cougar_storm_rate_ops, &cougar_storm_rate, 0600);
+MODULE_PARM_DESC(storm_rate,
+	"Vendor reports per second above which repeated reports are dropped (0=off) (default=0)");
+
+/*
+ * Returns true if the vendor report must be dropped: it repeats the
+ * previous one while the interface is above the storm_rate budget.
+ */
+bool cougar_storm_throttle(struct hid_device *hdev, struct cougar *cougar,
+			   unsigned char code, unsigned char action)
+{
+	struct cougar_storm *storm = READ_ONCE(cougar->storm);
+	u64 cost = READ_ONCE(cougar_storm_cost_ns);
+	u64 now = ktime_get_ns();
+	bool repeated;
+
+	if (!storm)
+		return false;
+
+	repeated = code == storm->last_code && action == storm->last_action;
+	storm->last_code = code;
+	storm->last_action = action;
+
+	if (storm->tat <= now)
+		storm->active = false;
+
+	if (repeated && storm->tat > now + COUGAR_STORM_BURST * cost) {
+		storm->dropped++;
+		if (!storm->active) {
+			storm->active = true;
+			storm->storms++;
+			if (!storm->logged) {
+				hid_warn(hdev,
+					 "vendor report storm above %u reports/s: dropping repeated reports\n",
+					 cougar_storm_rate);
+				storm->logged = true;
+			}
+		}
+		return true;
+	}
+
+	storm->tat = max(storm->tat, now) + cost;
+	return false;
+}
+
+static int cougar_storm_show(struct seq_file *m, void *unused)
+{
+	struct hid_device *hdev = m->private;
+	struct cougar *cougar = hid_get_drvdata(hdev);
+	struct cougar_storm *storm;
+
+	if (!cougar)
+		return -ENODEV;
+
+	storm = READ_ONCE(cougar->storm);
+	seq_printf(m, "storms %llu\ndropped %llu\nactive %d\n",
+		   storm ? storm->storms : 0, storm ? storm->dropped : 0,
+		   storm ? storm->active : 0);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(cougar_storm);
+
+/*
+ * Set up the throttle of a vendor intf once probed, if storm_rate is set
+ * already
+ */
+void cougar_storm_debugfs_init(struct hid_device *hdev, struct cougar *cougar)
+{
+	if (!cougar->special_intf)
+		return;
+
+	mutex_lock(&cougar_udev_list_lock);
+	if (cougar_storm_rate)
+		cougar_storm_alloc(cougar);
+	mutex_unlock(&cougar_udev_list_lock);
+	cougar->debug_storm = debugfs_create_file("cougar_storm", 0400,
+						  hdev->debug_dir, hdev,
+						  &cougar_storm_fops);
+}
+
+void cougar_storm_debugfs_exit(struct cougar *cougar)
+{
+	debugfs_remove(cougar->debug_storm);
+}
+
+/* Free the throttle state of an interface whose slot is being released */
+void cougar_storm_unbind(struct cougar *cougar)
+{
+	kfree(cougar->storm);
+	cougar->storm = NULL;
+}
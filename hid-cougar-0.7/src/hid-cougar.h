@@ -0,0 +1,1000 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#ifndef __HID_COUGAR_H
+#define __HID_COUGAR_H
+
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/hid.h>
+#include <linux/hidraw.h>
+#include <linux/hrtimer.h>
+#include <linux/jump_label.h>
+#include <linux/module.h>
+#include <linux/poll.h>
+#include <linux/rcupdate.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+
+#include "uapi/hid-cougar.h"
+
+/*
+ * The driver uses the current kernel APIs. These fallbacks keep it
+ * building on older kernels, down to 4.16.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 3, 0)
+static inline void vm_flags_clear(struct vm_area_struct *vma,
+				  unsigned long flags)
+{
+	vma->vm_flags &= ~flags;
+}
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
+#define cougar_rdesc_t	__u8
+#else
+#define cougar_rdesc_t	const __u8
+#endif
+
+#ifndef hid_warn_ratelimited
+#define hid_warn_ratelimited(hid, fmt, ...) \
+	dev_warn_ratelimited(&(hid)->dev, fmt, ##__VA_ARGS__)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 13, 0)
+static inline void hrtimer_setup(struct hrtimer *timer,
+				 enum hrtimer_restart (*function)(struct hrtimer *),
+				 clockid_t clock_id, enum hrtimer_mode mode)
+{
+	hrtimer_init(timer, clock_id, mode);
+	timer->function = function;
+}
+#endif
+
+#define USB_VENDOR_ID_SOLID_YEAR			0x060b
+#define USB_DEVICE_ID_COUGAR_700K_GAMING_KEYBOARD	0x700a
+
+#define COUGAR_VENDOR_USAGE	0xff00ff00
+
+#define COUGAR_FIELD_CODE	1
+#define COUGAR_FIELD_ACTION	2
+
+#define COUGAR_KEY_G1		0x83
+#define COUGAR_KEY_G2		0x84
+#define COUGAR_KEY_G3		0x85
+#define COUGAR_KEY_G4		0x86
+#define COUGAR_KEY_G5		0x87
+#define COUGAR_KEY_G6		0x78
+#define COUGAR_KEY_FN		0x0d
+#define COUGAR_KEY_MR		0x6f
+#define COUGAR_KEY_M1		0x80
+#define COUGAR_KEY_M2		0x81
+#define COUGAR_KEY_M3		0x82
+#define COUGAR_KEY_LEDS		0x67
+#define COUGAR_KEY_LOCK		0x6e
+
+/* A negative raw_event return keeps hid-core from parsing a report again */
+#define COUGAR_REPORT_CONSUMED	(-EALREADY)
+/* Same, for a vendor report dropped by the storm throttle */
+#define COUGAR_REPORT_THROTTLED	(-ENOBUFS)
+
+/*
+ * Whether keys reported by hid-input go through the keyboard hooks, see
+ * cougar_keys_decode()
+ */
+#if defined(COUGAR_RING) || defined(COUGAR_LAYER) || \
+    defined(COUGAR_DUAL_ROLE) || defined(COUGAR_AGGREGATE) || \
+    defined(COUGAR_REPEAT)
+#define COUGAR_KEYBOARD_HOOKS
+#endif
+
+/* Event ring, see uapi/hid-cougar.h */
+struct cougar_ring {
+	struct kref kref;
+	spinlock_t lock;	/* serializes producers and reader wake marks */
+	wait_queue_head_t wait;
+	struct list_head readers;
+	struct cougar_ring_header *hdr;
+	struct cougar_ring_record *rec;
+	u32 mask;
+	u64 wake;		/* earliest 'wake' of the readers */
+};
+
+/*
+ * 'mark' is the head the reader last read, and 'wake' the head at which
+ * it is to be woken next
+ */
+struct cougar_ring_reader {
+	struct list_head list;
+	struct cougar_ring *ring;
+	u64 mark;
+	u64 wake;
+	unsigned int threshold;
+};
+
+/*
+ * Momentary layer: while the vendor key 'shift_code' is held, keys of the
+ * keyboard intf are translated through 'map' (identity where unchanged).
+ * 'layered' holds the keys pressed through it, which keep their layer
+ * code until released.
+ */
+struct cougar_layer {
+	unsigned char shift_code;
+	u16 map[KEY_CNT];
+	unsigned long layered[BITS_TO_LONGS(KEY_CNT)];
+};
+
+/* Modifier classes of the G-key table, see cougar_mod_class() */
+enum {
+	COUGAR_MOD_NONE,
+	COUGAR_MOD_SHIFT,
+	COUGAR_MOD_CTRL,
+	COUGAR_MOD_ALT,
+	COUGAR_MOD_ALTGR,
+	COUGAR_MOD_META,
+	COUGAR_MOD_CLASSES
+};
+
+/*
+ * Modifier-aware G-key table: 'map[class][code]' is the key sent for the
+ * vendor key 'code' pressed while modifier class 'class' is held, 0 for
+ * the default mapping. 'down' keeps the key sent on press, so that the
+ * release matches it whatever the modifiers are by then.
+ */
+struct cougar_modmap {
+	u16 map[COUGAR_MOD_CLASSES][256];
+	u16 down[256];
+};
+
+#define COUGAR_DUAL_ROLE_MAX	8
+#define COUGAR_DUAL_ROLE_QUEUE	8
+
+/*
+ * Dual-role key: 'code' emits 'tap' when released before tap_hold_us, or
+ * acts as 'hold' when held longer or while another key is pressed and
+ * released.
+ */
+struct cougar_dual_role_key {
+	u16 code;
+	u16 tap;
+	u16 hold;
+};
+
+struct cougar_dual_role {
+	struct rcu_head rcu;
+	unsigned int count;
+	struct cougar_dual_role_key keys[COUGAR_DUAL_ROLE_MAX];
+};
+
+struct cougar_key_event {
+	struct input_dev *input;
+	u16 code;
+	s32 value;
+};
+
+struct cougar_dual_hold {
+	struct input_dev *input;
+	u16 code;
+	u16 hold;
+};
+
+/*
+ * At most one dual-role key waits for its tap/hold decision at a time;
+ * events of other keys are queued meanwhile and replayed once decided.
+ */
+struct cougar_dual_state {
+	struct cougar_shared *shared;
+	spinlock_t lock;
+	struct hrtimer timer;
+	ktime_t deadline;
+	bool pending;
+	struct cougar_dual_role_key key;
+	struct input_dev *input;
+	unsigned int held;
+	struct cougar_dual_hold holding[COUGAR_DUAL_ROLE_MAX];
+	unsigned int queued;
+	struct cougar_key_event queue[COUGAR_DUAL_ROLE_QUEUE];
+};
+
+#define COUGAR_REPEAT_MAX	8
+
+struct cougar_held_key {
+	u16 code;
+	ktime_t next;
+};
+
+/*
+ * Autorepeat of the keyboard intf's input device, taken over from the
+ * input core: every held key repeats on its own schedule, following the
+ * device's REP_DELAY and REP_PERIOD, from a single timer armed for the
+ * earliest of them while keys are held.
+ */
+struct cougar_repeat_state {
+	spinlock_t lock;
+	struct hrtimer timer;
+	struct input_dev *input;
+	unsigned int held;
+	struct cougar_held_key keys[COUGAR_REPEAT_MAX];
+};
+
+/* Mouse keys actions, see cougar_mouse_names */
+enum {
+	COUGAR_MOUSE_NONE,
+	COUGAR_MOUSE_UP,
+	COUGAR_MOUSE_DOWN,
+	COUGAR_MOUSE_LEFT,
+	COUGAR_MOUSE_RIGHT,
+	COUGAR_MOUSE_WHEEL_UP,
+	COUGAR_MOUSE_WHEEL_DOWN,
+	COUGAR_MOUSE_BUTTON_LEFT,
+	COUGAR_MOUSE_BUTTON_RIGHT,
+	COUGAR_MOUSE_BUTTON_MIDDLE,
+	COUGAR_MOUSE_ACTIONS
+};
+
+/* Actions up to this one move the pointer or the wheel */
+#define COUGAR_MOUSE_LAST_MOTION	COUGAR_MOUSE_WHEEL_DOWN
+
+/* Mouse keys: the action of each vendor key code */
+struct cougar_mousekeys {
+	u8 action[256];
+};
+
+/*
+ * Mouse keys pointer. While motion keys are held, 'timer' emits the
+ * motion every 'period', from sub-pixel accumulators in thousandths.
+ */
+struct cougar_mouse_state {
+	spinlock_t lock;
+	struct hrtimer timer;
+	struct input_dev *input;
+	unsigned long held;	/* BIT(action) of the held motion keys */
+	ktime_t since;
+	ktime_t period;
+	s64 acc_x;
+	s64 acc_y;
+	s64 acc_wheel;
+	char phys[64];
+};
+
+struct cougar_inject_stats {
+	u64 reports;
+	u64 dropped;
+	u64 throttled;
+	u64 elapsed_ns;
+};
+
+/*
+ * Vendor report storm state, a GCRA token bucket: 'tat' is the time at
+ * which the bucket would be empty again.
+ */
+struct cougar_storm {
+	u64 tat;
+	u64 dropped;
+	u64 storms;
+	bool active;
+	bool logged;
+	unsigned char last_code;
+	unsigned char last_action;
+};
+
+/*
+ * Probe phase durations in ns. first_event is the time from the start of
+ * probe to the first report accepted by the interface.
+ */
+struct cougar_probe_times {
+	ktime_t start;
+	u64 parse;
+	u64 hw_start;
+	u64 lock_wait;
+	u64 bind;
+	u64 open;
+	u64 total;
+	u64 first_event;
+};
+
+#define COUGAR_STATS_REPORT_MAX	16
+
+/*
+ * Report statistics of an interface, allocated while stats are enabled.
+ * Probe times are only known for interfaces probed meanwhile.
+ */
+struct cougar_stats {
+	u64 reports;
+	u64 repeated;
+	int last_size;
+	u8 last[COUGAR_STATS_REPORT_MAX];
+	struct cougar_probe_times probe;
+};
+
+/* Smallest key bitmap handled by the NKRO decoder */
+#define COUGAR_NKRO_MIN_KEYS	64
+
+/*
+ * NKRO decoder for an input report made only of 1-bit key fields: 'usage'
+ * gives the HID usage of every payload bit (NULL for none), whose code is
+ * read on each change so keymap updates apply, and 'state' the payload of
+ * the previous report.
+ */
+struct cougar_nkro {
+	unsigned int report_id;
+	unsigned int numbered;
+	unsigned int bytes;
+	struct input_dev *input;
+	struct hid_usage **usage;
+	unsigned long *state;
+	unsigned long *next;
+	unsigned long *changed;
+};
+
+/*
+ * Per-interface state. That of the optional subsystems is allocated on
+ * first use, and freed with the interface's slot, see cougar_unbind().
+ */
+struct cougar {
+	bool special_intf;
+	struct cougar_shared *shared;
+#ifdef COUGAR_RING
+	struct dentry *debug_events;
+#endif
+#ifdef COUGAR_INJECT
+	bool removing;
+	struct dentry *debug_inject;
+	struct cougar_inject_stats *inject;
+#endif
+#ifdef COUGAR_STORM
+	struct dentry *debug_storm;
+	struct cougar_storm *storm;
+#endif
+#ifdef COUGAR_STATS
+	struct cougar_stats *stats;
+	struct dentry *debug_stats;
+	struct dentry *debug_probe;
+	struct dentry *debug_memory;
+#endif
+#ifdef COUGAR_NKRO
+	struct cougar_nkro *nkro;
+#endif
+#ifdef COUGAR_REPEAT
+	bool repeat;
+#endif
+#ifdef COUGAR_KEYBOARD_HOOKS
+	unsigned long *key_reports;	/* IDs of the reports made of keys */
+#endif
+};
+
+#define COUGAR_AGGREGATE_NAME_MAX	32
+
+/*
+ * Aggregated keyboard: one input device fed by the keys of every group
+ * that joined it by name. 'count' is the number of groups holding each
+ * key, so a key is only released once no keyboard holds it any more.
+ */
+struct cougar_aggregate {
+	struct list_head list;
+	unsigned int users;
+	spinlock_t lock;
+	struct input_dev *input;
+	char name[COUGAR_AGGREGATE_NAME_MAX];
+	char phys[COUGAR_AGGREGATE_NAME_MAX + 16];
+	u8 count[KEY_CNT];
+};
+
+/* A group's membership of an aggregated keyboard, with the keys it holds */
+struct cougar_aggregate_member {
+	struct cougar_aggregate *agg;
+	unsigned long held[BITS_TO_LONGS(KEY_CNT)];
+};
+
+/*
+ * The per-interface state of a keyboard's interfaces (keyboard, mouse
+ * and vendor) lives in its group's shared data, so that a keyboard costs
+ * a single driver allocation until optional subsystems are used. A slot
+ * is in use while its 'shared' is set.
+ */
+#define COUGAR_MAX_INTF		3
+
+struct cougar_shared {
+	struct list_head list;
+	struct kref kref;
+	bool enabled;
+	struct hid_device *dev;
+	struct input_dev *input;
+	unsigned int g6_key;	/* key held down by G6, 0 if none */
+#ifdef COUGAR_RING
+	struct cougar_ring *ring;
+#endif
+#ifdef COUGAR_LAYER
+	struct cougar_layer __rcu *layer_map;
+	bool shifted;		/* layer_map's shift key is held */
+#endif
+#ifdef COUGAR_MODMAP
+	struct cougar_modmap __rcu *modmap;
+#endif
+#ifdef COUGAR_DUAL_ROLE
+	struct cougar_dual_role __rcu *dual_role;
+	struct cougar_dual_state *dual;		/* once first configured */
+#endif
+#ifdef COUGAR_MOUSEKEYS
+	struct cougar_mousekeys __rcu *mousekeys;
+	struct cougar_mouse_state *mouse;	/* once first configured */
+#endif
+#ifdef COUGAR_REPEAT
+	struct cougar_repeat_state *repeat;	/* once first started */
+#endif
+#ifdef COUGAR_AGGREGATE
+	struct cougar_aggregate_member __rcu *aggregate;
+#endif
+	struct cougar intf[COUGAR_MAX_INTF];
+};
+
+extern struct list_head cougar_udev_list;
+extern struct mutex cougar_udev_list_lock;
+
+void cougar_key(struct cougar_shared *shared, struct input_dev *input,
+		unsigned int code, s32 value);
+bool cougar_keyboard_key(struct cougar_shared *shared, struct input_dev *input,
+			 unsigned int code, s32 value);
+void cougar_update_keybits(struct cougar_shared *shared);
+void cougar_for_each_intf(void (*fn)(struct cougar *cougar));
+
+/*
+ * Optional subsystems, each built from its own object when selected in
+ * the Makefile (which then defines COUGAR_<name>), and otherwise reduced
+ * to the empty stubs below. The stages of the event path are also gated
+ * by static keys, enabled while at least one device uses the feature, so
+ * that the default path stays a plain lookup and emit.
+ */
+
+/* hid-cougar-stats.c */
+#ifdef COUGAR_STATS
+DECLARE_STATIC_KEY_FALSE(cougar_stats_key);
+
+static inline bool cougar_stats_active(void)
+{
+	return static_branch_unlikely(&cougar_stats_key);
+}
+
+void cougar_stats_account(struct cougar *cougar, u8 *data, int size);
+void cougar_stats_accepted(struct cougar *cougar);
+void cougar_stats_probe(struct cougar *cougar,
+			const struct cougar_probe_times *t);
+void cougar_stats_debugfs_init(struct hid_device *hdev, struct cougar *cougar);
+void cougar_stats_debugfs_exit(struct cougar *cougar);
+void cougar_stats_unbind(struct cougar *cougar);
+#else
+static inline bool cougar_stats_active(void)
+{
+	return false;
+}
+
+static inline void cougar_stats_account(struct cougar *cougar, u8 *data,
+					int size)
+{
+}
+
+static inline void cougar_stats_accepted(struct cougar *cougar)
+{
+}
+
+static inline void cougar_stats_probe(struct cougar *cougar,
+				      const struct cougar_probe_times *t)
+{
+}
+
+static inline void cougar_stats_debugfs_init(struct hid_device *hdev,
+					     struct cougar *cougar)
+{
+}
+
+static inline void cougar_stats_debugfs_exit(struct cougar *cougar)
+{
+}
+
+static inline void cougar_stats_unbind(struct cougar *cougar)
+{
+}
+#endif
+
+/* hid-cougar-inject.c */
+#ifdef COUGAR_INJECT
+static inline size_t cougar_inject_memory(struct cougar *cougar)
+{
+	return READ_ONCE(cougar->inject) ? sizeof(*cougar->inject) : 0;
+}
+
+void cougar_inject_debugfs_init(struct hid_device *hdev, struct cougar *cougar);
+void cougar_inject_debugfs_exit(struct cougar *cougar);
+void cougar_inject_unbind(struct cougar *cougar);
+#else
+static inline size_t cougar_inject_memory(struct cougar *cougar)
+{
+	return 0;
+}
+
+static inline void cougar_inject_debugfs_init(struct hid_device *hdev,
+					      struct cougar *cougar)
+{
+}
+
+static inline void cougar_inject_debugfs_exit(struct cougar *cougar)
+{
+}
+
+static inline void cougar_inject_unbind(struct cougar *cougar)
+{
+}
+#endif
+
+/* hid-cougar-ring.c */
+#ifdef COUGAR_RING
+DECLARE_STATIC_KEY_FALSE(cougar_ring_key);
+
+static inline bool cougar_ring_active(void)
+{
+	return static_branch_unlikely(&cougar_ring_key);
+}
+
+static inline size_t cougar_ring_memory(struct cougar_shared *shared)
+{
+	if (!shared->ring)
+		return 0;
+	return sizeof(*shared->ring) + PAGE_SIZE +
+	       (shared->ring->mask + 1) * sizeof(*shared->ring->rec);
+}
+
+void cougar_ring_push(struct cougar_shared *shared, u8 source, u16 code,
+		      s32 action);
+int cougar_ring_init(struct cougar_shared *shared);
+void cougar_ring_exit(struct cougar_shared *shared);
+void cougar_ring_debugfs_init(struct hid_device *hdev, struct cougar *cougar);
+void cougar_ring_debugfs_exit(struct cougar *cougar);
+#else
+static inline bool cougar_ring_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_ring_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline void cougar_ring_push(struct cougar_shared *shared, u8 source,
+				    u16 code, s32 action)
+{
+}
+
+static inline int cougar_ring_init(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline void cougar_ring_exit(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_ring_debugfs_init(struct hid_device *hdev,
+					    struct cougar *cougar)
+{
+}
+
+static inline void cougar_ring_debugfs_exit(struct cougar *cougar)
+{
+}
+#endif
+
+/* hid-cougar-storm.c */
+#ifdef COUGAR_STORM
+DECLARE_STATIC_KEY_FALSE(cougar_storm_key);
+
+static inline bool cougar_storm_active(void)
+{
+	return static_branch_unlikely(&cougar_storm_key);
+}
+
+static inline size_t cougar_storm_memory(struct cougar *cougar)
+{
+	return READ_ONCE(cougar->storm) ? sizeof(*cougar->storm) : 0;
+}
+
+bool cougar_storm_throttle(struct hid_device *hdev, struct cougar *cougar,
+			   unsigned char code, unsigned char action);
+void cougar_storm_debugfs_init(struct hid_device *hdev, struct cougar *cougar);
+void cougar_storm_debugfs_exit(struct cougar *cougar);
+void cougar_storm_unbind(struct cougar *cougar);
+#else
+static inline bool cougar_storm_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_storm_memory(struct cougar *cougar)
+{
+	return 0;
+}
+
+static inline bool cougar_storm_throttle(struct hid_device *hdev,
+					 struct cougar *cougar,
+					 unsigned char code,
+					 unsigned char action)
+{
+	return false;
+}
+
+static inline void cougar_storm_debugfs_init(struct hid_device *hdev,
+					     struct cougar *cougar)
+{
+}
+
+static inline void cougar_storm_debugfs_exit(struct cougar *cougar)
+{
+}
+
+static inline void cougar_storm_unbind(struct cougar *cougar)
+{
+}
+#endif
+
+/* hid-cougar-layer.c */
+#ifdef COUGAR_LAYER
+DECLARE_STATIC_KEY_FALSE(cougar_layer_key);
+extern struct device_attribute cougar_attr_layer;
+
+static inline bool cougar_layer_active(void)
+{
+	return static_branch_unlikely(&cougar_layer_key);
+}
+
+static inline size_t cougar_layer_memory(struct cougar_shared *shared)
+{
+	return rcu_access_pointer(shared->layer_map) ?
+	       sizeof(struct cougar_layer) : 0;
+}
+
+bool cougar_layer_shift(struct cougar_shared *shared, unsigned char code,
+			unsigned char action);
+unsigned int cougar_layer_resolve(struct cougar_shared *shared,
+				  struct input_dev *input, unsigned int code,
+				  __s32 value);
+void cougar_layer_keybits(struct cougar_shared *shared);
+void cougar_layer_exit(struct cougar_shared *shared);
+#else
+static inline bool cougar_layer_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_layer_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline bool cougar_layer_shift(struct cougar_shared *shared,
+				      unsigned char code, unsigned char action)
+{
+	return false;
+}
+
+static inline unsigned int cougar_layer_resolve(struct cougar_shared *shared,
+						struct input_dev *input,
+						unsigned int code, __s32 value)
+{
+	return code;
+}
+
+static inline void cougar_layer_keybits(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_layer_exit(struct cougar_shared *shared)
+{
+}
+#endif
+
+/* hid-cougar-modmap.c */
+#ifdef COUGAR_MODMAP
+DECLARE_STATIC_KEY_FALSE(cougar_modmap_key);
+extern struct device_attribute cougar_attr_modmap;
+
+static inline bool cougar_modmap_active(void)
+{
+	return static_branch_unlikely(&cougar_modmap_key);
+}
+
+static inline size_t cougar_modmap_memory(struct cougar_shared *shared)
+{
+	return rcu_access_pointer(shared->modmap) ?
+	       sizeof(struct cougar_modmap) : 0;
+}
+
+unsigned int cougar_modmap_resolve(struct cougar_shared *shared,
+				   struct input_dev *input, unsigned char code,
+				   unsigned char action);
+void cougar_modmap_keybits(struct cougar_shared *shared);
+void cougar_modmap_exit(struct cougar_shared *shared);
+#else
+static inline bool cougar_modmap_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_modmap_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline unsigned int cougar_modmap_resolve(struct cougar_shared *shared,
+						 struct input_dev *input,
+						 unsigned char code,
+						 unsigned char action)
+{
+	return 0;
+}
+
+static inline void cougar_modmap_keybits(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_modmap_exit(struct cougar_shared *shared)
+{
+}
+#endif
+
+/* hid-cougar-dual.c */
+#ifdef COUGAR_DUAL_ROLE
+DECLARE_STATIC_KEY_FALSE(cougar_dual_key);
+extern struct device_attribute cougar_attr_dual_role;
+
+static inline bool cougar_dual_active(void)
+{
+	return static_branch_unlikely(&cougar_dual_key);
+}
+
+static inline size_t cougar_dual_memory(struct cougar_shared *shared)
+{
+	return (rcu_access_pointer(shared->dual_role) ?
+		sizeof(struct cougar_dual_role) : 0) +
+	       (shared->dual ? sizeof(*shared->dual) : 0);
+}
+
+bool cougar_dual_event(struct cougar_shared *shared, struct input_dev *input,
+		       unsigned int code, s32 value);
+void cougar_dual_keybits(struct cougar_shared *shared);
+void cougar_dual_release(struct cougar_shared *shared);
+void cougar_dual_exit(struct cougar_shared *shared);
+#else
+static inline bool cougar_dual_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_dual_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline bool cougar_dual_event(struct cougar_shared *shared,
+				     struct input_dev *input,
+				     unsigned int code, s32 value)
+{
+	return false;
+}
+
+static inline void cougar_dual_keybits(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_dual_release(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_dual_exit(struct cougar_shared *shared)
+{
+}
+#endif
+
+/* hid-cougar-mouse.c */
+#ifdef COUGAR_MOUSEKEYS
+DECLARE_STATIC_KEY_FALSE(cougar_mouse_key);
+extern struct device_attribute cougar_attr_mousekeys;
+
+static inline bool cougar_mouse_active(void)
+{
+	return static_branch_unlikely(&cougar_mouse_key);
+}
+
+static inline size_t cougar_mouse_memory(struct cougar_shared *shared)
+{
+	return (rcu_access_pointer(shared->mousekeys) ?
+		sizeof(struct cougar_mousekeys) : 0) +
+	       (shared->mouse ? sizeof(*shared->mouse) : 0);
+}
+
+bool cougar_mouse_event(struct cougar_shared *shared, unsigned char code,
+			unsigned char action);
+void cougar_mouse_exit(struct cougar_shared *shared);
+#else
+static inline bool cougar_mouse_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_mouse_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline bool cougar_mouse_event(struct cougar_shared *shared,
+				      unsigned char code, unsigned char action)
+{
+	return false;
+}
+
+static inline void cougar_mouse_exit(struct cougar_shared *shared)
+{
+}
+#endif
+
+/* hid-cougar-aggregate.c */
+#ifdef COUGAR_AGGREGATE
+DECLARE_STATIC_KEY_FALSE(cougar_aggregate_key);
+extern struct device_attribute cougar_attr_aggregate;
+
+static inline bool cougar_aggregate_active(void)
+{
+	return static_branch_unlikely(&cougar_aggregate_key);
+}
+
+static inline size_t cougar_aggregate_memory(struct cougar_shared *shared)
+{
+	return rcu_access_pointer(shared->aggregate) ?
+	       sizeof(struct cougar_aggregate_member) : 0;
+}
+
+void cougar_aggregate_event(struct cougar_shared *shared, unsigned int code,
+			    s32 value);
+void cougar_aggregate_release(struct cougar_shared *shared);
+void cougar_aggregate_exit(struct cougar_shared *shared);
+#else
+static inline bool cougar_aggregate_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_aggregate_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline void cougar_aggregate_event(struct cougar_shared *shared,
+					  unsigned int code, s32 value)
+{
+}
+
+static inline void cougar_aggregate_release(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_aggregate_exit(struct cougar_shared *shared)
+{
+}
+#endif
+
+/* hid-cougar-nkro.c */
+#ifdef COUGAR_NKRO
+DECLARE_STATIC_KEY_FALSE(cougar_nkro_key);
+
+/* Whether 'report' is the interface's NKRO report, decoded by the driver */
+static inline bool cougar_nkro_report(struct cougar *cougar,
+				      struct hid_report *report)
+{
+	return static_branch_unlikely(&cougar_nkro_key) && cougar->nkro &&
+	       report->id == cougar->nkro->report_id;
+}
+
+static inline size_t cougar_nkro_memory(struct cougar *cougar)
+{
+	struct cougar_nkro *nkro = cougar->nkro;
+
+	if (!nkro)
+		return 0;
+	return sizeof(*nkro) + nkro->bytes * 8 * sizeof(*nkro->usage) +
+	       3 * BITS_TO_LONGS(nkro->bytes * 8) * sizeof(unsigned long);
+}
+
+int cougar_nkro_decode(struct hid_device *hdev, struct cougar *cougar,
+		       u8 *data, int size);
+void cougar_nkro_setup(struct hid_device *hdev, struct cougar *cougar);
+void cougar_nkro_exit(struct cougar *cougar);
+#else
+static inline bool cougar_nkro_report(struct cougar *cougar,
+				      struct hid_report *report)
+{
+	return false;
+}
+
+static inline size_t cougar_nkro_memory(struct cougar *cougar)
+{
+	return 0;
+}
+
+static inline int cougar_nkro_decode(struct hid_device *hdev,
+				     struct cougar *cougar, u8 *data, int size)
+{
+	return 0;
+}
+
+static inline void cougar_nkro_setup(struct hid_device *hdev,
+				     struct cougar *cougar)
+{
+}
+
+static inline void cougar_nkro_exit(struct cougar *cougar)
+{
+}
+#endif
+
+/* hid-cougar-repeat.c */
+#ifdef COUGAR_REPEAT
+DECLARE_STATIC_KEY_FALSE(cougar_repeat_key);
+
+static inline bool cougar_repeat_active(void)
+{
+	return static_branch_unlikely(&cougar_repeat_key);
+}
+
+static inline size_t cougar_repeat_memory(struct cougar_shared *shared)
+{
+	return shared->repeat ? sizeof(*shared->repeat) : 0;
+}
+
+void cougar_repeat_event(struct cougar_shared *shared, struct input_dev *input,
+			 unsigned int code, s32 value);
+void cougar_repeat_exit(struct cougar_shared *shared);
+void cougar_repeat_start(struct cougar *cougar, struct input_dev *input);
+void cougar_repeat_stop(struct cougar *cougar);
+#else
+static inline bool cougar_repeat_active(void)
+{
+	return false;
+}
+
+static inline size_t cougar_repeat_memory(struct cougar_shared *shared)
+{
+	return 0;
+}
+
+static inline void cougar_repeat_event(struct cougar_shared *shared,
+				       struct input_dev *input,
+				       unsigned int code, s32 value)
+{
+}
+
+static inline void cougar_repeat_exit(struct cougar_shared *shared)
+{
+}
+
+static inline void cougar_repeat_start(struct cougar *cougar,
+				       struct input_dev *input)
+{
+}
+
+static inline void cougar_repeat_stop(struct cougar *cougar)
+{
+}
+#endif
+
+static inline bool cougar_keyboard_hooks(void)
+{
+	return cougar_ring_active() || cougar_layer_active() ||
+	       cougar_dual_active() || cougar_aggregate_active() ||
+	       cougar_repeat_active();
+}
+
+#endif
@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0+ WITH Linux-syscall-note */
+/*
+ *  HID driver for Cougar 700k Gaming Keyboard: userspace interface
+ *
+ *  Copyright (c) 2018 Daniel M. Lambea <dmlambea@gmail.com>
+ */
+
+#ifndef _UAPI_HID_COUGAR_H
+#define _UAPI_HID_COUGAR_H
+
+#include <linux/types.h>
+
+/*
+ * Event ring of a keyboard, enabled by the event_ring module parameter and
+ * shared read-only with userspace through mmap() of the debugfs file
+ * "cougar_events" of any of its HID devices. The header fills the first
+ * page and the records follow it, record 'seq' being at index
+ * seq & (size - 1).
+ *
+ * Readers load 'head' with acquire semantics, copy the records they are
+ * interested in and then reload 'head': any record whose sequence number
+ * is not above head - size has been overwritten meanwhile and must be
+ * discarded.
+ *
+ * Each open file is a reader of its own. read() returns the current head
+ * as a __u64 and marks everything up to it as consumed. poll() reports
+ * the file readable once at least 'threshold' records have been produced
+ * since, 1 by default, up to size / 2 written to the file as a decimal
+ * number. Readers are woken when their own threshold is reached, and then
+ * every 'threshold' records until they read.
+ */
+#define COUGAR_RING_VERSION	1
+
+#define COUGAR_RING_SRC_KEYBOARD	0
+#define COUGAR_RING_SRC_VENDOR		1
+
+struct cougar_ring_header {
+	__u32 version;		/* COUGAR_RING_VERSION */
+	__u32 size;		/* records, a power of two */
+	__u64 head;		/* sequence number of the next record */
+};
+
+struct cougar_ring_record {
+	__u64 timestamp;	/* CLOCK_MONOTONIC, in ns */
+	__u16 code;		/* EV_KEY code */
+	__u8 action;		/* EV_KEY value */
+	__u8 source;		/* COUGAR_RING_SRC_* */
+	__u32 reserved;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Compare the per-report cost of the in-module translation (hid-cougar) and
+# of the HID-BPF program (hid-generic + bpf/hid_cougar.bpf.o) on the same
+# hid-recorder trace, replayed through uhid.
+#
+# usage: bench-bpf.sh <hid_cougar.bpf.o> <recording>...
+#
+# Needs root, uhid, hid-cougar built and udev-hid-bpf in $PATH.
+
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 <hid_cougar.bpf.o> <recording>..." >&2
+	exit 2
+fi
+
+BPF_OBJ=$(realpath "$1")
+shift
+LOOPS=${LOOPS:-1000}
+REPLAY=$(dirname "$0")/cougar-replay
+DEVICES="/sys/bus/hid/devices/*:060B:700A.*"
+
+echo "== in-module (hid-cougar)"
+modprobe hid-cougar
+"$REPLAY" -n "$LOOPS" "$@"
+
+echo "== HID-BPF (hid-generic)"
+modprobe -r hid-cougar
+"$REPLAY" -n "$LOOPS" \
+	-x "for d in $DEVICES; do udev-hid-bpf add \$d $BPF_OBJ; done" "$@"
+modprobe hid-cougar
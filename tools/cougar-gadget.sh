@@ -0,0 +1,105 @@
+#!/bin/sh
+#
+# Present a recorded keyboard to this machine over USB: every device of a
+# hid-recorder capture becomes one interface (a configfs HID function) of
+# a composite gadget with the Cougar ids, bound to dummy_hcd, so the host
+# side enumerates it through usbhid exactly like the real keyboard.
+#
+# usage: cougar-gadget.sh up <recording>
+#        cougar-gadget.sh down
+#
+# Needs root and a kernel with dummy_hcd, libcomposite and usb_f_hid. Once
+# up, the gadget side reports are written to /dev/hidg<N>, N following the
+# device order of the recording, e.g. with "cougar-replay -g 0 recording".
+
+set -e
+
+GADGET=/sys/kernel/config/usb_gadget/cougar
+SERIAL=${SERIAL:-cougar-gadget}
+
+hex_to_bin() {
+	for b in "$@"; do
+		printf "\\$(printf %03o "0x$b")"
+	done
+}
+
+up() {
+	rec=$1
+
+	modprobe libcomposite
+	modprobe dummy_hcd
+	mountpoint -q /sys/kernel/config ||
+		mount -t configfs none /sys/kernel/config
+
+	udc=$(ls /sys/class/udc | grep dummy_udc | head -n 1)
+	if [ -z "$udc" ]; then
+		echo "no dummy_udc found" >&2
+		exit 1
+	fi
+
+	mkdir "$GADGET"
+	echo 0x060b > "$GADGET/idVendor"
+	echo 0x700a > "$GADGET/idProduct"
+	echo 0x0110 > "$GADGET/bcdDevice"
+	echo 0x0200 > "$GADGET/bcdUSB"
+	mkdir "$GADGET/strings/0x409"
+	echo "$SERIAL" > "$GADGET/strings/0x409/serialnumber"
+	echo "Cougar" > "$GADGET/strings/0x409/manufacturer"
+	awk '/^N:/ { sub(/^N: */, ""); print; exit }' "$rec" \
+		> "$GADGET/strings/0x409/product"
+	mkdir "$GADGET/configs/c.1"
+	echo 100 > "$GADGET/configs/c.1/MaxPower"
+
+	# One line per report descriptor: "<device> <bytes...>"
+	awk '/^D:/ { d = $2 } /^R:/ { $1 = ""; $2 = ""; print d + 0, $0 }' "$rec" |
+	while read -r dev bytes; do
+		fn="$GADGET/functions/hid.usb$dev"
+		mkdir "$fn"
+		# Boot keyboard for the keyboard interface, none for the others
+		case "$bytes" in
+		"05 01 09 06 "*)
+			echo 1 > "$fn/subclass"
+			echo 1 > "$fn/protocol"
+			;;
+		*)
+			echo 0 > "$fn/subclass"
+			echo 0 > "$fn/protocol"
+			;;
+		esac
+		echo 64 > "$fn/report_length"
+		# shellcheck disable=SC2086
+		hex_to_bin $bytes > "$fn/report_desc"
+		ln -s "$fn" "$GADGET/configs/c.1/"
+	done
+
+	echo "$udc" > "$GADGET/UDC"
+	echo "gadget bound to $udc, serial $SERIAL"
+	ls /dev/hidg* 2>/dev/null || true
+}
+
+down() {
+	[ -d "$GADGET" ] || exit 0
+	echo "" > "$GADGET/UDC" || true
+	rm -f "$GADGET"/configs/c.1/hid.usb*
+	rmdir "$GADGET"/configs/c.1
+	rmdir "$GADGET"/functions/hid.usb*
+	rmdir "$GADGET/strings/0x409"
+	rmdir "$GADGET"
+}
+
+case "$1" in
+up)
+	if [ $# -ne 2 ]; then
+		echo "usage: $0 up <recording>" >&2
+		exit 2
+	fi
+	up "$2"
+	;;
+down)
+	down
+	;;
+*)
+	echo "usage: $0 up <recording> | down" >&2
+	exit 2
+	;;
+esac
@@ -0,0 +1,1396 @@
+// SPDX-License-Identifier: GPL-2.0+
+/*
+ *  Replay hid-recorder captures through uhid and time every report
+ *
+ *  Each device found in the recordings ("D:" sections, or one per file)
+ *  is recreated with its original descriptor, name, phys and ids, so
+ *  hid-cougar binds the emulated interfaces and finds their siblings
+ *  exactly as it does with the real keyboard. The captured reports are
+ *  then injected back to back, ignoring their timestamps, and the time
+ *  spent in each UHID_INPUT2 write (which runs the whole hid-core,
+ *  driver and input core path synchronously) is reported.
+ *
+ *  With -p, the recordings are instead used as a template for a hotplug
+ *  storm: every cycle plugs that many copies of the recorded keyboard at
+ *  once (each with its own phys prefix, so each forms its own hid-cougar
+ *  group), waits for hid-cougar to bind all of them, sends the first
+ *  recorded report of each interface, collects the probe phase breakdown
+ *  from debugfs and unplugs everything again.
+ *
+ *  With -c, every recorded device is created twice, once for hid-cougar
+ *  and once (with its product id cleared) for hid-generic, each report is
+ *  sent to both and the evdev events it produced on each side are
+ *  compared. Differences are only accepted if a rule of allowlist[]
+ *  explains them.
+ *
+ *  With -g, nothing is created through uhid: the reports are written to
+ *  the /dev/hidg<N> nodes of a USB HID gadget set up by cougar-gadget.sh
+ *  on dummy_hcd, so they go through the UDC, usbhid's interrupt URBs,
+ *  hid-core and hid-cougar before reaching evdev. The time from each
+ *  write to its first evdev event is reported.
+ *
+ *  With -k, G6 press and release reports are sent to the vendor interface
+ *  back to back from a second thread while the keymap is switched that
+ *  many times (g6_is_space by default, or any parameter or attribute
+ *  given with -K). The time spent in each UHID_INPUT2 write overlapping a
+ *  switch is compared to the others, and the time from the start of each
+ *  switch to the first G6 press reported with the new key is measured.
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uhid.h>
+
+#define MAX_DEVICES	16
+
+#define HID_SYSFS	"/sys/bus/hid/devices"
+#define HID_DEBUGFS	"/sys/kernel/debug/hid"
+#define STATS_PARAM	"/sys/module/hid_cougar/parameters/stats"
+
+#define MAX_NODES	16
+#define MAX_EVENTS	256
+
+#define GADGET_UNIQ	"cougar-gadget"
+#define GADGET_SILENT_MS	20
+
+#define G6_PARAM	"/sys/module/hid_cougar/parameters/g6_is_space"
+#define COUGAR_FIELD_CODE	1
+#define COUGAR_FIELD_ACTION	2
+#define COUGAR_KEY_G6		0x78
+#define RELOAD_INTERVAL_MS	50
+
+struct replay_dev {
+	struct uhid_create2_req create;
+	int fd;
+	unsigned long reports;
+	uint64_t total_ns;
+};
+
+struct replay_event {
+	double timestamp;
+	unsigned long index;
+	int dev;
+	unsigned int size;
+	unsigned char *data;
+};
+
+static struct replay_dev devices[MAX_DEVICES];
+static int ndevices;
+static struct replay_event *events;
+static unsigned long nevents, events_alloc;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int parse_bytes(char *s, unsigned char *buf, unsigned int max)
+{
+	unsigned int n = 0;
+	char *end;
+
+	while (n < max) {
+		unsigned long v = strtoul(s, &end, 16);
+
+		if (end == s)
+			break;
+		buf[n++] = v;
+		s = end;
+	}
+	return n;
+}
+
+static int parse_recording(const char *path)
+{
+	unsigned char buf[UHID_DATA_MAX];
+	int base = ndevices, cur = ndevices;
+	char line[16384];
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct uhid_create2_req *c;
+		char *arg = line + 2;
+
+		if (line[0] == '#' || line[1] != ':')
+			continue;
+		if (line[0] == 'D') {
+			cur = base + atoi(arg);
+			continue;
+		}
+		if (cur >= MAX_DEVICES) {
+			fprintf(stderr, "%s: too many devices\n", path);
+			fclose(f);
+			return -1;
+		}
+		if (cur >= ndevices)
+			ndevices = cur + 1;
+		c = &devices[cur].create;
+
+		switch (line[0]) {
+		case 'N':
+			arg[strcspn(arg, "\n")] = '\0';
+			snprintf((char *)c->name, sizeof(c->name), "%.127s", arg + 1);
+			break;
+		case 'P':
+			arg[strcspn(arg, "\n")] = '\0';
+			snprintf((char *)c->phys, sizeof(c->phys), "%.63s", arg + 1);
+			break;
+		case 'I': {
+			unsigned int bus = 0, vendor = 0, product = 0;
+
+			sscanf(arg, "%x %x %x", &bus, &vendor, &product);
+			c->bus = bus;
+			c->vendor = vendor;
+			c->product = product;
+			break;
+		}
+		case 'R':
+			strtoul(arg, &arg, 10);
+			c->rd_size = parse_bytes(arg, c->rd_data,
+						 sizeof(c->rd_data));
+			break;
+		case 'E': {
+			struct replay_event *ev;
+
+			if (nevents == events_alloc) {
+				events_alloc = events_alloc ? events_alloc * 2 : 4096;
+				events = realloc(events,
+						 events_alloc * sizeof(*events));
+				if (!events) {
+					perror("realloc");
+					exit(1);
+				}
+			}
+			ev = &events[nevents];
+			ev->timestamp = strtod(arg, &arg);
+			strtoul(arg, &arg, 10);
+			ev->size = parse_bytes(arg, buf, sizeof(buf));
+			ev->data = malloc(ev->size);
+			if (!ev->data) {
+				perror("malloc");
+				exit(1);
+			}
+			memcpy(ev->data, buf, ev->size);
+			ev->dev = cur;
+			ev->index = nevents++;
+			break;
+		}
+		}
+	}
+	fclose(f);
+	return 0;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+	const struct replay_event *ea = a, *eb = b;
+
+	if (ea->timestamp != eb->timestamp)
+		return ea->timestamp < eb->timestamp ? -1 : 1;
+	return ea->index < eb->index ? -1 : ea->index > eb->index;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+
+	return ua < ub ? -1 : ua > ub;
+}
+
+static int create_device(struct replay_dev *dev)
+{
+	struct uhid_event ev;
+
+	dev->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC | O_NONBLOCK);
+	if (dev->fd < 0) {
+		perror("/dev/uhid");
+		return -1;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = UHID_CREATE2;
+	ev.u.create2 = dev->create;
+	if (write(dev->fd, &ev, sizeof(ev)) < 0) {
+		perror("UHID_CREATE2");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Consume uhid notifications, failing any report request from the driver
+ * so that it never waits for its timeout.
+ */
+static void drain_device(struct replay_dev *dev)
+{
+	struct uhid_event ev, reply;
+
+	while (read(dev->fd, &ev, sizeof(ev)) > 0) {
+		memset(&reply, 0, sizeof(reply));
+		if (ev.type == UHID_GET_REPORT) {
+			reply.type = UHID_GET_REPORT_REPLY;
+			reply.u.get_report_reply.id = ev.u.get_report.id;
+			reply.u.get_report_reply.err = EIO;
+		} else if (ev.type == UHID_SET_REPORT) {
+			reply.type = UHID_SET_REPORT_REPLY;
+			reply.u.set_report_reply.id = ev.u.set_report.id;
+			reply.u.set_report_reply.err = EIO;
+		} else {
+			continue;
+		}
+		if (write(dev->fd, &reply, sizeof(reply)) < 0)
+			perror("uhid reply");
+	}
+}
+
+static void drain_all(void)
+{
+	int i;
+
+	for (i = 0; i < ndevices; i++)
+		drain_device(&devices[i]);
+}
+
+static void settle(unsigned int ms)
+{
+	uint64_t end = now_ns() + ms * 1000000ull;
+	struct timespec ts = { 0, 10 * 1000000 };
+
+	do {
+		drain_all();
+		nanosleep(&ts, NULL);
+	} while (now_ns() < end);
+}
+
+static int inject(struct replay_dev *dev, const struct replay_event *rev,
+		  uint64_t *elapsed)
+{
+	struct uhid_event ev;
+	size_t len = offsetof(struct uhid_event, u.input2.data) + rev->size;
+	uint64_t start;
+
+	ev.type = UHID_INPUT2;
+	ev.u.input2.size = rev->size;
+	memcpy(ev.u.input2.data, rev->data, rev->size);
+
+	start = now_ns();
+	if (write(dev->fd, &ev, len) < 0) {
+		perror("UHID_INPUT2");
+		return -1;
+	}
+	*elapsed = now_ns() - start;
+	return 0;
+}
+
+/* Fields of the cougar_probe debugfs file collected in hotplug mode */
+static const char * const probe_fields[] = {
+	"parse", "hw_start", "lock_wait", "bind", "open", "total", "first_event",
+};
+#define NFIELDS	(sizeof(probe_fields) / sizeof(probe_fields[0]))
+
+struct hotplug_dev {
+	struct replay_dev dev;
+	const struct replay_event *first;
+	char hid[32];
+	int bound;
+};
+
+static void print_samples(const char *name, uint64_t *samples, unsigned long n)
+{
+	uint64_t sum = 0;
+	unsigned long i;
+
+	if (!n)
+		return;
+	qsort(samples, n, sizeof(*samples), cmp_u64);
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+	printf("%-12s mean %8lu ns, p50 %8lu ns, p99 %8lu ns, max %8lu ns\n",
+	       name, (unsigned long)(sum / n), (unsigned long)samples[n / 2],
+	       (unsigned long)samples[n * 99 / 100],
+	       (unsigned long)samples[n - 1]);
+}
+
+/*
+ * Copy recorded device d for keyboard k, moving it to its own phys prefix
+ * (hid-cougar groups interfaces by what precedes the last '/') and giving
+ * it a uniq string to find it in sysfs.
+ */
+static void clone_device(struct hotplug_dev *hd, int k, int d)
+{
+	const struct uhid_create2_req *c = &devices[d].create;
+	const char *phys = (const char *)c->phys;
+	const char *slash = strrchr(phys, '/');
+	int prefix = slash ? slash - phys : (int)strlen(phys);
+	unsigned long i;
+
+	memset(hd, 0, sizeof(*hd));
+	hd->dev.create = *c;
+	snprintf((char *)hd->dev.create.phys, sizeof(hd->dev.create.phys),
+		 "%.*s.k%d%s", prefix, phys, k, slash ? slash : "");
+	snprintf((char *)hd->dev.create.uniq, sizeof(hd->dev.create.uniq),
+		 "cougar-hotplug-%d-%d", k, d);
+
+	for (i = 0; i < nevents; i++) {
+		if (events[i].dev == d) {
+			hd->first = &events[i];
+			break;
+		}
+	}
+}
+
+/* Find the hid device created for hd and whether driver is bound to it */
+static int lookup_device(struct hotplug_dev *hd, const char *driver)
+{
+	char path[512], line[256], uniq[96];
+	struct dirent *de;
+	ssize_t len;
+	DIR *dir;
+	FILE *f;
+
+	if (hd->bound)
+		return 0;
+
+	snprintf(uniq, sizeof(uniq), "HID_UNIQ=%s\n",
+		 (const char *)hd->dev.create.uniq);
+	if (!hd->hid[0]) {
+		dir = opendir(HID_SYSFS);
+		if (!dir)
+			return -1;
+		while ((de = readdir(dir))) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), HID_SYSFS "/%s/uevent",
+				 de->d_name);
+			f = fopen(path, "r");
+			if (!f)
+				continue;
+			while (fgets(line, sizeof(line), f))
+				if (!strcmp(line, uniq))
+					snprintf(hd->hid, sizeof(hd->hid),
+						 "%.31s", de->d_name);
+			fclose(f);
+			if (hd->hid[0])
+				break;
+		}
+		closedir(dir);
+		if (!hd->hid[0])
+			return -1;
+	}
+
+	snprintf(path, sizeof(path), HID_SYSFS "/%s/driver", hd->hid);
+	len = readlink(path, line, sizeof(line) - 1);
+	if (len < 0)
+		return -1;
+	line[len] = '\0';
+	hd->bound = !strcmp(strrchr(line, '/') ? strrchr(line, '/') + 1 : line,
+			    driver);
+	return hd->bound ? 0 : -1;
+}
+
+static int read_probe_times(struct hotplug_dev *hd, uint64_t *values,
+			    unsigned long *groups, unsigned long *refs)
+{
+	char path[256], name[32];
+	unsigned long long v;
+	unsigned int i;
+	FILE *f;
+
+	snprintf(path, sizeof(path), HID_DEBUGFS "/%s/cougar_probe", hd->hid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	while (fscanf(f, "%31s %llu", name, &v) == 2) {
+		for (i = 0; i < NFIELDS; i++)
+			if (!strcmp(name, probe_fields[i]))
+				values[i] = v;
+		if (!strcmp(name, "groups"))
+			*groups = v;
+		else if (!strcmp(name, "group_refs"))
+			*refs = v;
+	}
+	fclose(f);
+	return 0;
+}
+
+static void enable_stats(void)
+{
+	FILE *f = fopen(STATS_PARAM, "w");
+
+	if (!f || fputs("1", f) < 0 || fclose(f))
+		fprintf(stderr, "warning: cannot enable %s, first_event will be 0\n",
+			STATS_PARAM);
+}
+
+static int hotplug(unsigned int keyboards, unsigned int cycles,
+		   unsigned int timeout_ms)
+{
+	unsigned long nhd = keyboards * ndevices, nsamples = 0, errors = 0;
+	uint64_t *samples[NFIELDS], *ready, start, deadline;
+	struct hotplug_dev *hd;
+	unsigned long i, groups, refs;
+	unsigned int cycle, f, pending;
+	uint64_t elapsed;
+	int k, d;
+
+	hd = calloc(nhd, sizeof(*hd));
+	ready = calloc(cycles, sizeof(*ready));
+	for (f = 0; f < NFIELDS; f++)
+		samples[f] = calloc(nhd * cycles, sizeof(uint64_t));
+	if (!hd || !ready || !samples[NFIELDS - 1]) {
+		perror("calloc");
+		return 1;
+	}
+	enable_stats();
+
+	for (cycle = 0; cycle < cycles; cycle++) {
+		for (k = 0; k < (int)keyboards; k++)
+			for (d = 0; d < ndevices; d++)
+				clone_device(&hd[k * ndevices + d], k, d);
+
+		/* uhid adds the devices from a workqueue, so they probe concurrently */
+		start = now_ns();
+		for (i = 0; i < nhd; i++)
+			if (create_device(&hd[i].dev))
+				return 1;
+
+		deadline = start + timeout_ms * 1000000ull;
+		do {
+			pending = 0;
+			for (i = 0; i < nhd; i++) {
+				drain_device(&hd[i].dev);
+				if (lookup_device(&hd[i], "cougar"))
+					pending++;
+			}
+		} while (pending && now_ns() < deadline);
+		ready[cycle] = now_ns() - start;
+		if (pending) {
+			fprintf(stderr, "cycle %u: %u interfaces not bound\n",
+				cycle, pending);
+			errors += pending;
+		}
+
+		for (i = 0; i < nhd; i++) {
+			uint64_t values[NFIELDS] = { 0 };
+
+			if (!hd[i].bound)
+				continue;
+			if (hd[i].first && inject(&hd[i].dev, hd[i].first, &elapsed))
+				return 1;
+			drain_device(&hd[i].dev);
+
+			groups = refs = 0;
+			if (read_probe_times(&hd[i], values, &groups, &refs)) {
+				fprintf(stderr, "%s: no cougar_probe in debugfs\n",
+					hd[i].hid);
+				errors++;
+				continue;
+			}
+			if (groups != keyboards || refs != (unsigned long)ndevices) {
+				fprintf(stderr, "%s: %lu groups, %lu refs (expected %u, %d)\n",
+					hd[i].hid, groups, refs, keyboards, ndevices);
+				errors++;
+			}
+			for (f = 0; f < NFIELDS; f++)
+				samples[f][nsamples] = values[f];
+			nsamples++;
+		}
+
+		for (i = 0; i < nhd; i++)
+			close(hd[i].dev.fd);
+	}
+
+	printf("%u cycles of %u keyboards (%d interfaces each), %lu probes, %lu errors\n",
+	       cycles, keyboards, ndevices, nsamples, errors);
+	for (f = 0; f < NFIELDS; f++)
+		print_samples(probe_fields[f], samples[f], nsamples);
+	print_samples("all_bound", ready, cycles);
+	return errors ? 1 : 0;
+}
+
+/* One instance of every recorded device, bound to the same driver */
+struct conform_side {
+	const char *driver;
+	struct hotplug_dev hd[MAX_DEVICES];
+	int nodes[MAX_NODES];
+	int nnodes;
+	uint64_t total_ns;
+	struct input_event ev[MAX_EVENTS];
+	int nev;
+};
+
+/* Descriptor checks mirroring the driver's */
+static int is_vendor_intf(const struct uhid_create2_req *c)
+{
+	return c->rd_size > 3 && c->rd_data[0] == 0x06 &&
+	       c->rd_data[1] == 0x00 && c->rd_data[2] == 0xff;
+}
+
+/* Same limit as COUGAR_RDESC_USAGE_MAX in the driver */
+#define RDESC_USAGE_MAX	0x3ff
+
+static int needs_rdesc_fixup(const struct uhid_create2_req *c)
+{
+	return c->rd_size > 116 && c->rd_data[2] == 0x09 &&
+	       c->rd_data[3] == 0x02 &&
+	       (c->rd_data[115] | c->rd_data[116] << 8) > RDESC_USAGE_MAX;
+}
+
+static int only_keys(const struct conform_side *side)
+{
+	int i;
+
+	for (i = 0; i < side->nev; i++)
+		if (side->ev[i].type != EV_KEY && side->ev[i].type != EV_SYN)
+			return 0;
+	return 1;
+}
+
+/* The driver's default G-key mapping, see cougar_mapping[] in the driver */
+static const struct {
+	unsigned char code;
+	unsigned short key;
+} gkeys[] = {
+	{ 0x83, KEY_F13 },
+	{ 0x84, KEY_F14 },
+	{ 0x85, KEY_F15 },
+	{ 0x86, KEY_F16 },
+	{ 0x87, KEY_F17 },
+	{ COUGAR_KEY_G6, KEY_SPACE },	/* KEY_F18 unless g6_is_space */
+	{ 0x6e, KEY_SCREENLOCK },
+};
+
+/* Value of the g6_is_space parameter, read when the comparison starts */
+static int g6_is_space = 1;
+
+static void read_g6_is_space(void)
+{
+	FILE *f = fopen(G6_PARAM, "r");
+
+	if (!f)
+		return;
+	if (fscanf(f, "%d", &g6_is_space) != 1)
+		g6_is_space = 1;
+	fclose(f);
+}
+
+static unsigned int gkey_for(unsigned char code)
+{
+	unsigned int i;
+
+	if (code == COUGAR_KEY_G6 && !g6_is_space)
+		return KEY_F18;
+	for (i = 0; i < sizeof(gkeys) / sizeof(gkeys[0]); i++)
+		if (gkeys[i].code == code)
+			return gkeys[i].key;
+	return 0;
+}
+
+/*
+ * G-keys: hid-generic has nothing to map the vendor page to, hid-cougar
+ * sends the translated key (without MSC_SCAN) to the keyboard interface:
+ * the key the report's vendor code maps to, pressed or released as the
+ * report's action says (or repeated by the input core meanwhile).
+ */
+static int allow_gkeys(const struct uhid_create2_req *c,
+		       const struct replay_event *rev,
+		       const struct conform_side *generic,
+		       const struct conform_side *cougar)
+{
+	unsigned int key, keys = 0;
+	int i, action;
+
+	if (!is_vendor_intf(c) || generic->nev || !only_keys(cougar) ||
+	    rev->size <= COUGAR_FIELD_ACTION)
+		return 0;
+
+	key = gkey_for(rev->data[COUGAR_FIELD_CODE]);
+	action = !!rev->data[COUGAR_FIELD_ACTION];
+	if (!key)
+		return 0;
+
+	for (i = 0; i < cougar->nev; i++) {
+		if (cougar->ev[i].type != EV_KEY)
+			continue;
+		if (cougar->ev[i].code != key ||
+		    (cougar->ev[i].value != action && cougar->ev[i].value != 2))
+			return 0;
+		keys++;
+	}
+	return keys > 0;
+}
+
+static const struct {
+	const char *what;
+	int (*match)(const struct uhid_create2_req *c,
+		     const struct replay_event *rev,
+		     const struct conform_side *generic,
+		     const struct conform_side *cougar);
+} allowlist[] = {
+	{ "translated G-keys", allow_gkeys },
+};
+#define NALLOW	(sizeof(allowlist) / sizeof(allowlist[0]))
+
+static void open_nodes(struct conform_side *side, int n)
+{
+	char path[512];
+	struct dirent *in, *ev;
+	DIR *dir, *sub;
+	int d, fd;
+
+	for (d = 0; d < n; d++) {
+		if (!side->hd[d].bound)
+			continue;
+		snprintf(path, sizeof(path), HID_SYSFS "/%s/input",
+			 side->hd[d].hid);
+		dir = opendir(path);
+		if (!dir)
+			continue;
+		while ((in = readdir(dir))) {
+			if (strncmp(in->d_name, "input", 5))
+				continue;
+			snprintf(path, sizeof(path), HID_SYSFS "/%s/input/%s",
+				 side->hd[d].hid, in->d_name);
+			sub = opendir(path);
+			if (!sub)
+				continue;
+			while ((ev = readdir(sub))) {
+				if (strncmp(ev->d_name, "event", 5) ||
+				    side->nnodes == MAX_NODES)
+					continue;
+				snprintf(path, sizeof(path), "/dev/input/%s",
+					 ev->d_name);
+				fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+				if (fd < 0)
+					perror(path);
+				else
+					side->nodes[side->nnodes++] = fd;
+			}
+			closedir(sub);
+		}
+		closedir(dir);
+	}
+}
+
+/*
+ * Collect the events queued on all the side's nodes. evdev queues them
+ * synchronously from the UHID_INPUT2 write, so they all belong to the
+ * last report. Autorepeat events depend on timing and are skipped.
+ */
+static void collect_events(struct conform_side *side)
+{
+	struct input_event ev;
+	int i;
+
+	side->nev = 0;
+	for (i = 0; i < side->nnodes; i++) {
+		while (read(side->nodes[i], &ev, sizeof(ev)) == sizeof(ev)) {
+			if (ev.type == EV_KEY && ev.value == 2)
+				continue;
+			if (side->nev < MAX_EVENTS)
+				side->ev[side->nev++] = ev;
+		}
+	}
+}
+
+static int same_events(const struct conform_side *a,
+		       const struct conform_side *b)
+{
+	int i;
+
+	if (a->nev != b->nev)
+		return 0;
+	for (i = 0; i < a->nev; i++)
+		if (a->ev[i].type != b->ev[i].type ||
+		    a->ev[i].code != b->ev[i].code ||
+		    a->ev[i].value != b->ev[i].value)
+			return 0;
+	return 1;
+}
+
+static void print_events(const char *driver, const struct conform_side *side)
+{
+	int i;
+
+	printf("  %s:", driver);
+	for (i = 0; i < side->nev; i++)
+		printf(" %u:%u:%d", side->ev[i].type, side->ev[i].code,
+		       side->ev[i].value);
+	printf("\n");
+}
+
+/*
+ * hid-core rejects the consumer/system control interface's descriptor
+ * as recorded, so hid-generic is given the one hid-cougar fixes it up to
+ * and both sides must then produce the same events.
+ */
+static int conform_create(struct conform_side *side, int k)
+{
+	struct uhid_create2_req *c;
+	int d;
+
+	for (d = 0; d < ndevices; d++) {
+		clone_device(&side->hd[d], k, d);
+		c = &side->hd[d].dev.create;
+		if (k) {
+			c->product = 0;
+			if (needs_rdesc_fixup(c)) {
+				c->rd_data[115] = RDESC_USAGE_MAX & 0xff;
+				c->rd_data[116] = RDESC_USAGE_MAX >> 8;
+			}
+		}
+		if (create_device(&side->hd[d].dev))
+			return -1;
+	}
+	return 0;
+}
+
+static int conform(unsigned int loops, unsigned int settle_ms)
+{
+	static struct conform_side cougar = { .driver = "cougar" };
+	static struct conform_side generic = { .driver = "hid-generic" };
+	unsigned long n, total = nevents * loops, mismatches = 0;
+	unsigned long allowed[NALLOW] = { 0 };
+	struct timespec ts = { 0, 10 * 1000000 };
+	uint64_t elapsed, deadline;
+	unsigned int pending, a;
+	int d;
+
+	if (conform_create(&cougar, 0) || conform_create(&generic, 1))
+		return 1;
+	read_g6_is_space();
+
+	deadline = now_ns() + settle_ms * 1000000ull;
+	do {
+		pending = 0;
+		for (d = 0; d < ndevices; d++) {
+			drain_device(&cougar.hd[d].dev);
+			drain_device(&generic.hd[d].dev);
+			pending += !!lookup_device(&cougar.hd[d], cougar.driver);
+			pending += !!lookup_device(&generic.hd[d], generic.driver);
+		}
+	} while (pending && now_ns() < deadline);
+	for (d = 0; d < ndevices; d++)
+		if (!cougar.hd[d].bound)
+			fprintf(stderr, "warning: hid-cougar not bound to device %d\n",
+				d);
+
+	/* Give udev time to create the event nodes */
+	deadline = now_ns() + settle_ms * 1000000ull;
+	while (now_ns() < deadline) {
+		for (d = 0; d < ndevices; d++) {
+			drain_device(&cougar.hd[d].dev);
+			drain_device(&generic.hd[d].dev);
+		}
+		nanosleep(&ts, NULL);
+	}
+	open_nodes(&cougar, ndevices);
+	open_nodes(&generic, ndevices);
+	collect_events(&cougar);
+	collect_events(&generic);
+
+	for (n = 0; n < total; n++) {
+		const struct replay_event *rev = &events[n % nevents];
+		const struct uhid_create2_req *c = &devices[rev->dev].create;
+
+		if (inject(&cougar.hd[rev->dev].dev, rev, &elapsed))
+			return 1;
+		cougar.total_ns += elapsed;
+		collect_events(&cougar);
+
+		if (inject(&generic.hd[rev->dev].dev, rev, &elapsed))
+			return 1;
+		generic.total_ns += elapsed;
+		collect_events(&generic);
+
+		if (!(n & 1023)) {
+			for (d = 0; d < ndevices; d++) {
+				drain_device(&cougar.hd[d].dev);
+				drain_device(&generic.hd[d].dev);
+			}
+		}
+
+		if (same_events(&generic, &cougar))
+			continue;
+		for (a = 0; a < NALLOW; a++)
+			if (allowlist[a].match(c, rev, &generic, &cougar))
+				break;
+		if (a < NALLOW) {
+			allowed[a]++;
+			continue;
+		}
+
+		if (mismatches++ < 20) {
+			printf("report %lu on device %d (%s) differs:\n", n,
+			       rev->dev, (const char *)c->name);
+			print_events("hid-generic", &generic);
+			print_events("hid-cougar", &cougar);
+		}
+	}
+
+	printf("%lu reports, %lu mismatches\n", total, mismatches);
+	for (a = 0; a < NALLOW; a++)
+		if (allowed[a])
+			printf("allowed (%s): %lu\n", allowlist[a].what,
+			       allowed[a]);
+	printf("mean per report: hid-generic %lu ns, hid-cougar %lu ns\n",
+	       (unsigned long)(generic.total_ns / total),
+	       (unsigned long)(cougar.total_ns / total));
+
+	for (d = 0; d < ndevices; d++) {
+		close(cougar.hd[d].dev.fd);
+		close(generic.hd[d].dev.fd);
+	}
+	return mismatches ? 1 : 0;
+}
+
+/*
+ * Find the host side interfaces of the gadget, all of which carry its
+ * serial number as uniq, and return how many of them the driver is bound
+ * to.
+ */
+static int lookup_gadget(struct conform_side *side)
+{
+	char path[512], line[256];
+	struct dirent *de;
+	ssize_t len;
+	DIR *dir;
+	FILE *f;
+	int n = 0, found;
+
+	dir = opendir(HID_SYSFS);
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir)) && n < MAX_DEVICES) {
+		if (de->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), HID_SYSFS "/%s/uevent", de->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		found = 0;
+		while (fgets(line, sizeof(line), f))
+			if (!strcmp(line, "HID_UNIQ=" GADGET_UNIQ "\n"))
+				found = 1;
+		fclose(f);
+		if (!found)
+			continue;
+
+		snprintf(path, sizeof(path), HID_SYSFS "/%s/driver", de->d_name);
+		len = readlink(path, line, sizeof(line) - 1);
+		if (len < 0)
+			continue;
+		line[len] = '\0';
+		if (strcmp(strrchr(line, '/') ? strrchr(line, '/') + 1 : line,
+			   side->driver))
+			continue;
+		snprintf(side->hd[n].hid, sizeof(side->hd[n].hid), "%.31s",
+			 de->d_name);
+		side->hd[n++].bound = 1;
+	}
+	closedir(dir);
+	return n;
+}
+
+/*
+ * Wait for the events of the report just written: until a SYN_REPORT is
+ * read, or for GADGET_SILENT_MS if the report produces none. Returns the
+ * CLOCK_MONOTONIC time of the first event, or 0.
+ */
+static uint64_t gadget_events(struct conform_side *side)
+{
+	struct pollfd pfd[MAX_NODES];
+	struct input_event ev;
+	uint64_t first = 0;
+	int i, synced = 0;
+
+	for (i = 0; i < side->nnodes; i++) {
+		pfd[i].fd = side->nodes[i];
+		pfd[i].events = POLLIN;
+	}
+	while (!synced && poll(pfd, side->nnodes, GADGET_SILENT_MS) > 0) {
+		for (i = 0; i < side->nnodes; i++) {
+			while (read(side->nodes[i], &ev, sizeof(ev)) == sizeof(ev)) {
+				if (ev.type == EV_KEY && ev.value == 2)
+					continue;
+				if (!first)
+					first = (uint64_t)ev.input_event_sec * 1000000000ull +
+						ev.input_event_usec * 1000ull;
+				if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+					synced = 1;
+			}
+		}
+	}
+	return first;
+}
+
+static int gadget(unsigned int base, unsigned int loops,
+		  unsigned int timeout_ms)
+{
+	static struct conform_side host = { .driver = "cougar" };
+	struct timespec ts = { 0, 10 * 1000000 };
+	unsigned long n, total = nevents * loops, nlat = 0, silent = 0;
+	uint64_t *write_ns, *latency, start, first, deadline;
+	int hidg[MAX_DEVICES], clock = CLOCK_MONOTONIC;
+	int d, i, bound;
+	char path[64];
+
+	for (d = 0; d < ndevices; d++) {
+		snprintf(path, sizeof(path), "/dev/hidg%u", base + d);
+		hidg[d] = open(path, O_WRONLY | O_CLOEXEC);
+		if (hidg[d] < 0) {
+			perror(path);
+			return 1;
+		}
+	}
+
+	deadline = now_ns() + timeout_ms * 1000000ull;
+	while ((bound = lookup_gadget(&host)) < ndevices && now_ns() < deadline)
+		nanosleep(&ts, NULL);
+	if (bound < ndevices)
+		fprintf(stderr, "warning: hid-cougar bound to %d of %d gadget interfaces\n",
+			bound, ndevices);
+
+	/* Give udev time to create the event nodes */
+	deadline = now_ns() + timeout_ms * 1000000ull;
+	while (now_ns() < deadline)
+		nanosleep(&ts, NULL);
+	open_nodes(&host, bound);
+	if (!host.nnodes) {
+		fprintf(stderr, "no event nodes for the gadget\n");
+		return 1;
+	}
+	for (i = 0; i < host.nnodes; i++)
+		if (ioctl(host.nodes[i], EVIOCSCLOCKID, &clock))
+			perror("EVIOCSCLOCKID");
+	collect_events(&host);
+
+	write_ns = malloc(total * sizeof(*write_ns));
+	latency = malloc(total * sizeof(*latency));
+	if (!write_ns || !latency) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (n = 0; n < total; n++) {
+		const struct replay_event *rev = &events[n % nevents];
+
+		start = now_ns();
+		if (write(hidg[rev->dev], rev->data, rev->size) < 0) {
+			perror("hidg write");
+			return 1;
+		}
+		write_ns[n] = now_ns() - start;
+
+		first = gadget_events(&host);
+		if (first > start)
+			latency[nlat++] = first - start;
+		else
+			silent++;
+	}
+
+	printf("%lu reports over %d interfaces, %lu without events\n", total,
+	       ndevices, silent);
+	print_samples("write", write_ns, total);
+	print_samples("to_evdev", latency, nlat);
+
+	for (i = 0; i < host.nnodes; i++)
+		close(host.nodes[i]);
+	for (d = 0; d < ndevices; d++)
+		close(hidg[d]);
+	return 0;
+}
+
+struct samples {
+	uint64_t *v;
+	unsigned long n, alloc;
+};
+
+static void add_sample(struct samples *s, uint64_t v)
+{
+	if (s->n == s->alloc) {
+		s->alloc = s->alloc ? s->alloc * 2 : 4096;
+		s->v = realloc(s->v, s->alloc * sizeof(*s->v));
+		if (!s->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->v[s->n++] = v;
+}
+
+/*
+ * Keymap reload benchmark state. 'begin' and 'end' delimit the switch in
+ * progress ('end' is 0 while it is being written) and are shared with the
+ * injecting thread, like 'pending', 'key' and 'stop'.
+ */
+struct reload {
+	const char *path;
+	const char *value[2];
+	struct conform_side side;
+	struct replay_dev *vendor;
+	struct replay_event report;
+	uint64_t begin, end;
+	int pending;
+	unsigned int key;	/* key reported for the last G6 press */
+	int stop;
+	struct samples idle, during, observed;
+};
+
+static int write_file(const char *path, const char *value)
+{
+	int fd = open(path, O_WRONLY | O_CLOEXEC);
+	ssize_t len = strlen(value);
+
+	if (fd < 0 || write(fd, value, len) != len) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return close(fd);
+}
+
+/* Send one G6 report and account for its write time and events */
+static int reload_send(struct reload *r, int action)
+{
+	uint64_t start, elapsed, begin, end, time;
+	struct input_event *ev;
+	int i;
+
+	r->report.data[COUGAR_FIELD_ACTION] = action;
+	start = now_ns();
+	if (inject(r->vendor, &r->report, &elapsed))
+		return -1;
+
+	begin = __atomic_load_n(&r->begin, __ATOMIC_ACQUIRE);
+	end = __atomic_load_n(&r->end, __ATOMIC_ACQUIRE);
+	if (begin && start + elapsed > begin && (!end || start < end))
+		add_sample(&r->during, elapsed);
+	else
+		add_sample(&r->idle, elapsed);
+
+	collect_events(&r->side);
+	if (!action)
+		return 0;
+	for (i = 0; i < r->side.nev; i++) {
+		ev = &r->side.ev[i];
+		if (ev->type != EV_KEY || ev->value != 1)
+			continue;
+		if (__atomic_load_n(&r->pending, __ATOMIC_ACQUIRE) &&
+		    ev->code != r->key) {
+			time = (uint64_t)ev->input_event_sec * 1000000000ull +
+			       ev->input_event_usec * 1000ull;
+			add_sample(&r->observed, time > begin ? time - begin : 0);
+			__atomic_store_n(&r->pending, 0, __ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&r->key, ev->code, __ATOMIC_RELEASE);
+		break;
+	}
+	return 0;
+}
+
+static void *reload_inject(void *arg)
+{
+	struct reload *r = arg;
+	unsigned long n;
+	int d;
+
+	for (n = 0; !__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE); n++) {
+		if (reload_send(r, 1) || reload_send(r, 0))
+			break;
+		if (!(n & 511))
+			for (d = 0; d < ndevices; d++)
+				drain_device(&r->side.hd[d].dev);
+	}
+	return NULL;
+}
+
+/* Parse "<file>|<value>|<value>" */
+static int reload_spec(struct reload *r, char *spec)
+{
+	char *a = strchr(spec, '|'), *b = a ? strchr(a + 1, '|') : NULL;
+
+	if (!b)
+		return -1;
+	*a = *b = '\0';
+	r->path = spec;
+	r->value[0] = a + 1;
+	r->value[1] = b + 1;
+	return 0;
+}
+
+static int reload(unsigned int swaps, unsigned int settle_ms, char *spec)
+{
+	static struct reload r = {
+		.path = G6_PARAM,
+		.value = { "0", "1" },
+		.side = { .driver = "cougar" },
+	};
+	struct timespec ts = { 0, RELOAD_INTERVAL_MS * 1000000 };
+	int clock = CLOCK_MONOTONIC, d, i;
+	struct samples writes = { 0 };
+	unsigned long missed = 0, n;
+	uint64_t deadline;
+	unsigned int pending;
+	char restore[256];
+	pthread_t thread;
+	ssize_t len;
+
+	if (spec && reload_spec(&r, spec)) {
+		fprintf(stderr, "-K expects <file>|<value>|<value>\n");
+		return 2;
+	}
+
+	/* The vendor interface and a report of it to use as G6 template */
+	for (d = 0; d < ndevices && !is_vendor_intf(&devices[d].create); d++)
+		;
+	for (n = 0; n < nevents && events[n].dev != d; n++)
+		;
+	if (n == nevents || events[n].size <= COUGAR_FIELD_ACTION) {
+		fprintf(stderr, "no vendor interface report in recordings\n");
+		return 1;
+	}
+	r.report = events[n];
+	r.report.data = malloc(r.report.size);
+	if (!r.report.data) {
+		perror("malloc");
+		return 1;
+	}
+	memcpy(r.report.data, events[n].data, r.report.size);
+	r.report.data[COUGAR_FIELD_CODE] = COUGAR_KEY_G6;
+	r.vendor = &r.side.hd[d].dev;
+
+	i = open(r.path, O_RDONLY | O_CLOEXEC);
+	len = i < 0 ? -1 : read(i, restore, sizeof(restore) - 1);
+	if (i >= 0)
+		close(i);
+	if (len < 0) {
+		perror(r.path);
+		return 1;
+	}
+	restore[len] = '\0';
+
+	if (conform_create(&r.side, 0))
+		return 1;
+	deadline = now_ns() + settle_ms * 1000000ull;
+	do {
+		pending = 0;
+		for (d = 0; d < ndevices; d++) {
+			drain_device(&r.side.hd[d].dev);
+			pending += !!lookup_device(&r.side.hd[d], r.side.driver);
+		}
+	} while (pending && now_ns() < deadline);
+	if (pending)
+		fprintf(stderr, "warning: hid-cougar not bound to %u devices\n",
+			pending);
+
+	/* Give udev time to create the event nodes */
+	deadline = now_ns() + settle_ms * 1000000ull;
+	while (now_ns() < deadline) {
+		for (d = 0; d < ndevices; d++)
+			drain_device(&r.side.hd[d].dev);
+		nanosleep(&ts, NULL);
+	}
+	open_nodes(&r.side, ndevices);
+	for (i = 0; i < r.side.nnodes; i++)
+		if (ioctl(r.side.nodes[i], EVIOCSCLOCKID, &clock))
+			perror("EVIOCSCLOCKID");
+	collect_events(&r.side);
+
+	if (pthread_create(&thread, NULL, reload_inject, &r)) {
+		perror("pthread_create");
+		return 1;
+	}
+	for (n = 0; n < swaps; n++) {
+		nanosleep(&ts, NULL);
+		if (__atomic_load_n(&r.pending, __ATOMIC_ACQUIRE))
+			missed++;
+		__atomic_store_n(&r.end, 0, __ATOMIC_RELEASE);
+		__atomic_store_n(&r.begin, now_ns(), __ATOMIC_RELEASE);
+		__atomic_store_n(&r.pending, 1, __ATOMIC_RELEASE);
+		if (write_file(r.path, r.value[n & 1]))
+			break;
+		__atomic_store_n(&r.end, now_ns(), __ATOMIC_RELEASE);
+		add_sample(&writes, r.end - r.begin);
+	}
+	nanosleep(&ts, NULL);
+	missed += __atomic_load_n(&r.pending, __ATOMIC_ACQUIRE);
+	__atomic_store_n(&r.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(thread, NULL);
+	write_file(r.path, restore);
+
+	printf("%lu switches of %s, %lu reports, %lu switches not observed\n",
+	       writes.n, r.path, r.idle.n + r.during.n, missed);
+	print_samples("switch", writes.v, writes.n);
+	print_samples("report", r.idle.v, r.idle.n);
+	print_samples("in_switch", r.during.v, r.during.n);
+	print_samples("observed", r.observed.v, r.observed.n);
+
+	for (i = 0; i < r.side.nnodes; i++)
+		close(r.side.nodes[i]);
+	for (d = 0; d < ndevices; d++)
+		close(r.side.hd[d].dev.fd);
+	return missed ? 1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n loops] [-d settle_ms] [-x command]\n"
+		"       [-p keyboards | -c | -g hidg | -k switches [-K file|value|value]]\n"
+		"       recording...\n"
+		"  -n loops      replay the merged recordings this many times (default 1),\n"
+		"                or number of hotplug cycles with -p\n"
+		"  -d settle_ms  wait for drivers to bind before replaying (default 1000),\n"
+		"                or bind timeout per cycle with -p\n"
+		"  -x command    run command through the shell once devices are bound,\n"
+		"                then settle again (e.g. to attach a HID-BPF program)\n"
+		"  -p keyboards  hotplug storm: plug and unplug this many copies of the\n"
+		"                recorded keyboard at once and report the probe phases\n"
+		"  -c            compare the evdev events of hid-cougar and hid-generic\n"
+		"                for every report, failing on unlisted differences\n"
+		"  -g hidg       write the reports to /dev/hidg<hidg + device> of the\n"
+		"                cougar-gadget.sh gadget and time them up to evdev\n"
+		"  -k switches   send G6 reports at full rate while switching the keymap\n"
+		"                this many times, and time the reports and the switches\n"
+		"  -K spec       what -k switches, as <file>|<value>|<value>\n"
+		"                (default " G6_PARAM "|0|1)\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int loops = 1, settle_ms = 1000, keyboards = 0, hidg = 0;
+	unsigned int switches = 0;
+	int compare = 0, usb = 0;
+	char *spec = NULL;
+	const char *command = NULL;
+	unsigned long i, n, total;
+	uint64_t *samples;
+	int opt, d;
+
+	while ((opt = getopt(argc, argv, "n:d:x:p:cg:k:K:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			settle_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			command = optarg;
+			break;
+		case 'p':
+			keyboards = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			compare = 1;
+			break;
+		case 'g':
+			hidg = strtoul(optarg, NULL, 0);
+			usb = 1;
+			break;
+		case 'k':
+			switches = strtoul(optarg, NULL, 0);
+			break;
+		case 'K':
+			spec = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || !loops)
+		usage(argv[0]);
+
+	for (; optind < argc; optind++)
+		if (parse_recording(argv[optind]))
+			return 1;
+	if (!nevents) {
+		fprintf(stderr, "no events in recordings\n");
+		return 1;
+	}
+	qsort(events, nevents, sizeof(*events), cmp_event);
+
+	if (keyboards)
+		return hotplug(keyboards, loops, settle_ms);
+	if (compare)
+		return conform(loops, settle_ms);
+	if (usb)
+		return gadget(hidg, loops, settle_ms);
+	if (switches)
+		return reload(switches, settle_ms, spec);
+
+	for (d = 0; d < ndevices; d++)
+		if (create_device(&devices[d]))
+			return 1;
+	settle(settle_ms);
+
+	if (command) {
+		if (system(command))
+			fprintf(stderr, "warning: '%s' failed\n", command);
+		settle(settle_ms);
+	}
+
+	total = nevents * loops;
+	samples = malloc(total * sizeof(*samples));
+	if (!samples) {
+		perror("malloc");
+		return 1;
+	}
+
+	for (n = 0; n < total; n++) {
+		const struct replay_event *rev = &events[n % nevents];
+		struct replay_dev *dev = &devices[rev->dev];
+
+		if (inject(dev, rev, &samples[n]))
+			return 1;
+		dev->reports++;
+		dev->total_ns += samples[n];
+		if (!(n & 1023))
+			drain_all();
+	}
+
+	for (d = 0; d < ndevices; d++)
+		if (devices[d].reports)
+			printf("device %d (%s): %lu reports, mean %lu ns\n", d,
+			       devices[d].create.phys, devices[d].reports,
+			       (unsigned long)(devices[d].total_ns /
+					       devices[d].reports));
+
+	qsort(samples, total, sizeof(*samples), cmp_u64);
+	for (i = 0, n = 0; i < total; i++)
+		n += samples[i];
+	printf("all: %lu reports, mean %lu ns, p50 %lu ns, p99 %lu ns, max %lu ns\n",
+	       total, n / total, (unsigned long)samples[total / 2],
+	       (unsigned long)samples[total * 99 / 100],
+	       (unsigned long)samples[total - 1]);
+
+	for (d = 0; d < ndevices; d++)
+		close(devices[d].fd);
+	return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# Report the size of the event path of a built hid-cougar.ko and, when a
+# bound interface is given, the driver callbacks hid-core makes for each
+# of its input reports and its cost measured through cougar_inject, so
+# that builds and module options can be compared before and after a change.
+#
+# usage: hotpath.sh <hid-cougar.ko> [<hid debugfs dir> [<report bytes...>]]
+#
+# e.g.   hotpath.sh hid-cougar.ko /sys/kernel/debug/hid/0003:060B:700A.0003 01 83 01
+#        hotpath.sh hid-cougar.ko /sys/kernel/debug/hid/0003:060B:700A.0001 00 00 04 00 00 00 00 00
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <hid-cougar.ko> [<hid debugfs dir> [<report bytes...>]]" >&2
+	exit 2
+fi
+
+KO=$1
+shift
+COUNT=${COUNT:-1000000}
+
+# Static functions may be inlined into their callers, and then show as 0
+for fn in cougar_raw_event cougar_event cougar_keys_decode cougar_keyboard_key; do
+	objdump -d --no-show-raw-insn "$KO" | awk -v fn="$fn" '
+		$0 ~ "<" fn ">:$" { on = 1; next }
+		on && /^$/ { exit }
+		on && /\t/ { n++ }
+		END { printf "%-20s %4d instructions\n", fn, n }'
+done
+
+if [ $# -ge 1 ]; then
+	DIR=$1
+	shift
+
+	# hid-core calls .event, when the driver has one, for every usage of
+	# the variable fields of a report, and for every changed array entry
+	if nm "$KO" | grep -q ' cougar_event$'; then
+		EVENT=1
+	else
+		EVENT=0
+	fi
+	awk -v event=$EVENT '
+		/^  [A-Z]+(\([0-9]+\))?\[/ {
+			input = $1 ~ /^INPUT/
+			if (input)
+				reports++
+			next
+		}
+		input && /Report Count\(/ {
+			count = $0
+			gsub(/[^0-9]/, "", count)
+			next
+		}
+		input && /Flags\(/ {
+			if ($0 ~ / Variable/)
+				var += count
+			else
+				arrays++
+		}
+		END {
+			printf "%d input reports: raw_event once per report, ", reports
+			if (event)
+				printf "event %d times plus once per changed entry of %d array fields\n",
+				       var, arrays
+			else
+				printf "no per-usage event callback\n"
+		}' "$DIR/rdesc"
+fi
+
+if [ $# -ge 1 ]; then
+	echo "$COUNT 0 $*" > "$DIR/cougar_inject"
+	cat "$DIR/cougar_inject"
+fi